@@ -0,0 +1,88 @@
+#include <Server.h>
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <print>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Forwards a compile to `neon --server`, without loading LLVM like the compiler itself has to
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::println(std::cerr, "Usage: {} <socket> [neon arguments...]", argv[0]);
+        return 1;
+    }
+
+    std::string socketPath = argv[1];
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        std::println(std::cerr, "Socket path is too long: {}", socketPath);
+        return 1;
+    }
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connection < 0 || connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        std::println(std::cerr, "Can't connect to {}: {}", socketPath, strerror(errno));
+        return 1;
+    }
+
+    std::string request = std::filesystem::current_path().string();
+    request.push_back('\0');
+    request.append("neon");
+    request.push_back('\0');
+    for (int i = 2; i < argc; i++)
+    {
+        request.append(argv[i]);
+        request.push_back('\0');
+    }
+
+    uint32_t size = request.size();
+    iovec sizeVector{&size, sizeof(size)};
+    int fileDescriptors[passedFileDescriptorCount] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fileDescriptors))] = {};
+    msghdr message{};
+    message.msg_iov = &sizeVector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    auto* controlMessage = CMSG_FIRSTHDR(&message);
+    controlMessage->cmsg_level = SOL_SOCKET;
+    controlMessage->cmsg_type = SCM_RIGHTS;
+    controlMessage->cmsg_len = CMSG_LEN(sizeof(fileDescriptors));
+    memcpy(CMSG_DATA(controlMessage), fileDescriptors, sizeof(fileDescriptors));
+
+    if (sendmsg(connection, &message, MSG_NOSIGNAL) != sizeof(size) ||
+        send(connection, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size()))
+    {
+        std::println(std::cerr, "Can't send the request to {}: {}", socketPath, strerror(errno));
+        return 1;
+    }
+
+    int32_t exitCode;
+    size_t received = 0;
+    while (received < sizeof(exitCode))
+    {
+        auto result = recv(connection, reinterpret_cast<char*>(&exitCode) + received, sizeof(exitCode) - received, 0);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+        {
+            std::println(std::cerr, "The server closed the connection without finishing the compile");
+            return 1;
+        }
+
+        received += result;
+    }
+
+    return exitCode;
+}
@@ -1,7 +1,7 @@
 #include "Type.h"
 #include <AST.h>
 
-Ref<ParsedFile> g_parsedFile;
+thread_local Ref<ParsedFile> g_parsedFile;
 
 void NumberExpressionAST::AdjustType(Ref<IntegerType> type)
 {
@@ -9,6 +9,11 @@ void NumberExpressionAST::AdjustType(Ref<IntegerType> type)
     this->type = type;
 }
 
+bool FunctionAST::IsCompilerRuntime() const
+{
+    return g_context->freestanding && block && (name == "memcpy" || name == "memmove" || name == "memset");
+}
+
 Ref<FunctionAST> ParsedFile::FindFunction(const std::string& name) const
 {
     for (const auto& function : functions)
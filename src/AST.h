@@ -7,11 +7,18 @@
 #include <Utils.h>
 #include <llvm/IR/Constant.h>
 #include <llvm/IR/Value.h>
+#include <llvm/Support/HashBuilder.h>
+#include <llvm/Support/ModRef.h>
+#include <llvm/Support/SHA256.h>
+#include <set>
 #include <variant>
 
 // FIXME: Use typedef or using ... = ...
 #define ExpressionOrStatement std::variant<Ref<StatementAST>, Ref<ExpressionAST>>
 
+// Hashes of the AST have to be the same across runs, they are used as keys of the object cache
+using StableHasher = llvm::HashBuilder<llvm::SHA256, llvm::endianness::little>;
+
 struct AST
 {
     Location location;
@@ -32,12 +39,16 @@ struct ExpressionAST : public AST
     }
 
     virtual void Dump(uint32_t indentCount) const = 0;
+    virtual void Hash(StableHasher& hasher) const = 0;
     virtual llvm::Value* Codegen(bool usedAsStatement = false) const = 0;
     virtual llvm::Value* RawCodegen() const { return Codegen(); }
     virtual void Typecheck() = 0;
     virtual Ref<Type> GetType() const = 0;
     virtual void DCE() const = 0;
-    virtual llvm::Constant* EvaluateAsConstant() const { g_context->Error(location, "Expression is not constant"); }
+    virtual void InferEffects() const = 0;
+    virtual llvm::Constant* TryEvaluateAsConstant() const { return nullptr; }
+
+    llvm::Constant* EvaluateAsConstant() const;
 };
 
 struct NumberExpressionAST : public ExpressionAST
@@ -55,11 +66,13 @@ struct NumberExpressionAST : public ExpressionAST
     void AdjustType(Ref<IntegerType> type);
 
     virtual void Dump(uint32_t indentCount) const override;
+    virtual void Hash(StableHasher& hasher) const override;
     virtual llvm::Value* Codegen(bool usedAsStatement = false) const override;
     virtual void Typecheck() override;
     virtual void DCE() const override;
+    virtual void InferEffects() const override;
     virtual inline Ref<Type> GetType() const override { return type; }
-    virtual llvm::Constant* EvaluateAsConstant() const override;
+    virtual llvm::Constant* TryEvaluateAsConstant() const override;
 };
 
 struct VariableExpressionAST : public ExpressionAST
@@ -68,6 +81,7 @@ struct VariableExpressionAST : public ExpressionAST
 
     // Assigned during typechecking
     mutable Ref<Type> type;
+    mutable bool isGlobal = false;
 
     inline VariableExpressionAST(Location location, const std::string& name)
         : ExpressionAST(location)
@@ -76,10 +90,13 @@ struct VariableExpressionAST : public ExpressionAST
     }
 
     virtual void Dump(uint32_t indentCount) const override;
+    virtual void Hash(StableHasher& hasher) const override;
     virtual llvm::Value* Codegen(bool usedAsStatement = false) const override;
     virtual llvm::Value* RawCodegen() const override;
     virtual void Typecheck() override;
     virtual void DCE() const override;
+    virtual void InferEffects() const override;
+    virtual llvm::Constant* TryEvaluateAsConstant() const override;
     virtual inline Ref<Type> GetType() const override { return type; }
 };
 
@@ -96,11 +113,13 @@ struct StringLiteralAST : public ExpressionAST
     }
 
     virtual void Dump(uint32_t indentCount) const override;
+    virtual void Hash(StableHasher& hasher) const override;
     virtual llvm::Value* Codegen(bool usedAsStatement = false) const override;
     virtual void Typecheck() override;
     virtual inline Ref<Type> GetType() const override { return type; }
     virtual void DCE() const override;
-    virtual llvm::Constant* EvaluateAsConstant() const override;
+    virtual void InferEffects() const override;
+    virtual llvm::Constant* TryEvaluateAsConstant() const override;
 };
 
 struct BinaryExpressionAST : public ExpressionAST
@@ -118,9 +137,12 @@ struct BinaryExpressionAST : public ExpressionAST
     }
 
     virtual void Dump(uint32_t indentCount) const override;
+    virtual void Hash(StableHasher& hasher) const override;
     virtual llvm::Value* Codegen(bool usedAsStatement = false) const override;
     virtual void Typecheck() override;
     virtual void DCE() const override;
+    virtual void InferEffects() const override;
+    virtual llvm::Constant* TryEvaluateAsConstant() const override;
     virtual inline Ref<Type> GetType() const override { return lhs->GetType(); }
 };
 
@@ -140,9 +162,12 @@ struct CallExpressionAST : public ExpressionAST
     }
 
     virtual void Dump(uint32_t indentCount) const override;
+    virtual void Hash(StableHasher& hasher) const override;
     virtual llvm::Value* Codegen(bool usedAsStatement = false) const override;
     virtual void Typecheck() override;
     virtual void DCE() const override;
+    virtual void InferEffects() const override;
+    virtual llvm::Constant* TryEvaluateAsConstant() const override;
     virtual inline Ref<Type> GetType() const override { return returnedType; }
 };
 
@@ -159,9 +184,12 @@ struct CastExpressionAST : public ExpressionAST
     }
 
     virtual void Dump(uint32_t indentCount) const override;
+    virtual void Hash(StableHasher& hasher) const override;
     virtual llvm::Value* Codegen(bool usedAsStatement = false) const override;
     virtual void Typecheck() override;
     virtual void DCE() const override;
+    virtual void InferEffects() const override;
+    virtual llvm::Constant* TryEvaluateAsConstant() const override;
     virtual inline Ref<Type> GetType() const override { return castedTo; }
 };
 
@@ -178,9 +206,11 @@ struct ArrayAccessExpressionAST : public ExpressionAST
     }
 
     virtual void Dump(uint32_t indentCount) const override;
+    virtual void Hash(StableHasher& hasher) const override;
     virtual llvm::Value* Codegen(bool usedAsStatement = false) const override;
     virtual void Typecheck() override;
     virtual void DCE() const override;
+    virtual void InferEffects() const override;
 
     virtual inline Ref<Type> GetType() const override
     {
@@ -204,9 +234,11 @@ struct DereferenceExpressionAST : public ExpressionAST
     }
 
     virtual void Dump(uint32_t indentCount) const override;
+    virtual void Hash(StableHasher& hasher) const override;
     virtual llvm::Value* Codegen(bool usedAsStatement = false) const override;
     virtual void Typecheck() override;
     virtual void DCE() const override;
+    virtual void InferEffects() const override;
 
     virtual inline Ref<Type> GetType() const override { return as<PointerType>(pointer->type.get())->underlayingType; }
 };
@@ -224,9 +256,11 @@ struct MemberAccessExpressionAST : public ExpressionAST
     }
 
     virtual void Dump(uint32_t indentCount) const override;
+    virtual void Hash(StableHasher& hasher) const override;
     virtual llvm::Value* Codegen(bool usedAsStatement = false) const override;
     virtual void Typecheck() override;
     virtual void DCE() const override;
+    virtual void InferEffects() const override;
     virtual inline Ref<Type> GetType() const override
     {
         return g_context->structs.at(as<StructType>(object->GetType())->name).members[memberName];
@@ -241,9 +275,11 @@ struct StatementAST : public AST
     }
 
     virtual void Dump(uint32_t indentCount) const = 0;
+    virtual void Hash(StableHasher& hasher) const = 0;
     virtual void Codegen() const = 0;
     virtual void Typecheck() = 0;
     virtual void DCE() const = 0;
+    virtual void InferEffects() const = 0;
 };
 
 struct ReturnStatementAST : public StatementAST
@@ -260,9 +296,11 @@ struct ReturnStatementAST : public StatementAST
     }
 
     virtual void Dump(uint32_t indentCount) const override;
+    virtual void Hash(StableHasher& hasher) const override;
     virtual void Codegen() const override;
     virtual void Typecheck() override;
     virtual void DCE() const override;
+    virtual void InferEffects() const override;
 };
 
 struct BlockAST : public AST
@@ -276,9 +314,11 @@ struct BlockAST : public AST
     }
 
     void Dump(uint32_t indentCount) const;
+    void Hash(StableHasher& hasher) const;
     void Codegen() const;
     void Typecheck();
-    void DCE() const;
+    void DCE();
+    void InferEffects() const;
 };
 
 struct IfStatementAST : public StatementAST
@@ -296,9 +336,11 @@ struct IfStatementAST : public StatementAST
     }
 
     virtual void Dump(uint32_t indentCount) const override;
+    virtual void Hash(StableHasher& hasher) const override;
     virtual void Codegen() const override;
     virtual void Typecheck() override;
     virtual void DCE() const override;
+    virtual void InferEffects() const override;
 };
 
 struct WhileStatementAST : public StatementAST
@@ -314,9 +356,11 @@ struct WhileStatementAST : public StatementAST
     }
 
     virtual void Dump(uint32_t indentCount) const override;
+    virtual void Hash(StableHasher& hasher) const override;
     virtual void Codegen() const override;
     virtual void Typecheck() override;
     virtual void DCE() const override;
+    virtual void InferEffects() const override;
 };
 
 struct VariableDefinitionAST : public StatementAST
@@ -327,6 +371,7 @@ struct VariableDefinitionAST : public StatementAST
     Ref<ExpressionAST> initialValue;
 
     bool used = false;
+    bool exported = false; // A const of a module, written to its interface
 
     inline VariableDefinitionAST(Location location, const std::string& name, Ref<Type> type, bool isConst, Ref<ExpressionAST> initialValue)
         : StatementAST(location)
@@ -338,9 +383,11 @@ struct VariableDefinitionAST : public StatementAST
     }
 
     virtual void Dump(uint32_t indentCount) const override;
+    virtual void Hash(StableHasher& hasher) const override;
     virtual void Codegen() const override;
     virtual void Typecheck() override;
     virtual void DCE() const override;
+    virtual void InferEffects() const override;
 };
 
 struct FunctionAST : public AST
@@ -349,6 +396,9 @@ struct FunctionAST : public AST
     {
         std::string name;
         Ref<Type> type;
+
+        // Assigned during effect inference
+        bool isWritten = true;
     };
 
     std::string name;
@@ -357,6 +407,14 @@ struct FunctionAST : public AST
     Ref<BlockAST> block;
 
     bool used = false;
+    bool exported = false; // Defined by a module for its importers, so it's visible to the linker
+    bool imported = false; // Declared by a module interface, its effects were inferred when the module was compiled
+
+    // Assigned during effect inference
+    std::set<std::string> callees;
+    llvm::MemoryEffects memoryEffects = llvm::MemoryEffects::unknown();
+    bool isRecursive = true;
+    bool willReturn = false;
 
     inline FunctionAST(Location location, const std::string& name, std::vector<Param> params, Ref<Type> returnType, Ref<BlockAST> block)
         : AST(location)
@@ -367,10 +425,20 @@ struct FunctionAST : public AST
     {
     }
 
+    FunctionPurity GetPurity() const;
+
+    // memcpy, memmove and memset of a freestanding build, LLVM calls them on its own so they're always kept and visible
+    // to the linker (see lib/Memory.ne)
+    bool IsCompilerRuntime() const;
+
     void Dump(uint32_t indentCount) const;
+    void Hash(StableHasher& hasher) const;
+    void HashSignature(StableHasher& hasher) const; // Everything callers depend on, but not the body
+    llvm::Function* CodegenDeclaration() const;
     llvm::Function* Codegen() const;
     void Typecheck();
     void DCE() const;
+    void InferEffects() const;
 };
 
 struct ParsedFile
@@ -389,8 +457,13 @@ struct ParsedFile
 
     void Dump(uint32_t indentCount = 0) const;
     void Codegen() const;
+    void ParallelCodegen(uint32_t jobs) const; // Splits the functions between threads and links the results
+    void CodegenPartition(bool definesGlobals, const std::vector<Ref<FunctionAST>>& definedFunctions) const;
     void Typecheck();
+    void Typecheck(const std::vector<std::vector<Ref<FunctionAST>>>& sourceFunctions); // Each source's functions on its own thread
     void DCE();
+    void InferEffects();
 };
 
-extern Ref<ParsedFile> g_parsedFile;
+// NOTE: Like g_context, every thread has its own
+extern thread_local Ref<ParsedFile> g_parsedFile;
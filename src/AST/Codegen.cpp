@@ -1,12 +1,18 @@
 #include "Type.h"
 #include <AST.h>
 #include <Context.h>
+#include <Timing.h>
 #include <TypeCasts.h>
 #include <llvm/ADT/APInt.h>
+#include <llvm/Analysis/ConstantFolding.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/IR/LegacyPassManager.h>
-#include <llvm/IR/Verifier.h>
+#include <llvm/Linker/Linker.h>
+#include <exception>
+#include <thread>
 
 struct VariableInfo
 {
@@ -47,7 +53,8 @@ struct VariableInfoGlobal : public VariableInfo
     virtual bool IsConst() const override { return global->isConstant(); }
 };
 
-static std::vector<std::map<std::string, Ref<VariableInfo>>> blockStack;
+// NOTE: Code generation state is per thread, so parts of the program can be generated in parallel
+static thread_local std::vector<std::map<std::string, Ref<VariableInfo>>> blockStack;
 [[nodiscard]] static Ref<VariableInfo> FindVariable(const std::string& name, Location location)
 {
     for (int i = blockStack.size() - 1; i >= 0; i--)
@@ -57,12 +64,29 @@ static std::vector<std::map<std::string, Ref<VariableInfo>>> blockStack;
             return block.at(name);
     }
 
-    std::println(std::cerr, "COMPILER ERROR: Variable not found at codegen stage, this is a typechecker or codegen bug");
-    exit(1);
+    g_context->Error(location, "COMPILER ERROR: Variable {} not found at codegen stage, this is a typechecker or codegen bug", name);
 }
 
-static bool isInsideFunction = false;
-static std::vector<llvm::DIScope*> debugScopes;
+static thread_local bool isInsideFunction = false;
+static thread_local std::vector<llvm::DIScope*> debugScopes;
+
+// Set when only a part of the program is generated on this thread, everything defined here has to stay
+// visible to the other parts until they are linked back together
+struct Partition
+{
+    bool definesGlobals;
+};
+
+static thread_local std::optional<Partition> currentPartition;
+
+// NOTE: A compilation on this thread that stopped at an error can leave its state behind
+static void ResetCodegenState()
+{
+    blockStack.clear();
+    isInsideFunction = false;
+    debugScopes.clear();
+    currentPartition.reset();
+}
 
 llvm::DIScope* GetCurrentScope()
 {
@@ -71,7 +95,8 @@ llvm::DIScope* GetCurrentScope()
 
 void AST::EmitLocation() const
 {
-    if (g_context->debug)
+    // NOTE: Locations are only meaningful inside of functions, the compile unit isn't a valid scope for them
+    if (g_context->debug && !debugScopes.empty())
     {
         auto scope = GetCurrentScope();
         g_context->builder->SetCurrentDebugLocation(llvm::DILocation::get(scope->getContext(), location.line, location.column, scope));
@@ -102,8 +127,16 @@ llvm::Value* VariableExpressionAST::RawCodegen() const
 llvm::Value* StringLiteralAST::Codegen(bool) const
 {
     EmitLocation();
-    auto value = EvaluateAsConstant();
-    return new llvm::GlobalVariable(*g_context->module, value->getType(), true, llvm::GlobalVariable::ExternalLinkage, value);
+    auto& global = g_context->stringLiterals[value];
+    if (!global)
+    {
+        auto stringStruct = EvaluateAsConstant();
+        global = new llvm::GlobalVariable(
+            *g_context->module, stringStruct->getType(), true, llvm::GlobalVariable::PrivateLinkage, stringStruct, ".string");
+        global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    }
+
+    return global;
 }
 
 llvm::Value* BinaryExpressionAST::Codegen(bool usedAsStatement) const
@@ -226,6 +259,11 @@ llvm::Value* BinaryExpressionAST::Codegen(bool usedAsStatement) const
 llvm::Value* CallExpressionAST::Codegen(bool) const
 {
     EmitLocation();
+
+    // Calls to pure functions with constant arguments are evaluated right away
+    if (auto constant = TryEvaluateAsConstant())
+        return constant;
+
     auto function = g_context->module->getFunction(calleeName);
     assert(function);
 
@@ -456,7 +494,7 @@ void VariableDefinitionAST::Codegen() const
         else
             blockStack.back()[name] = MakeRef<VariableInfoAlloca>(functionBeginBuilder.CreateAlloca(type->GetType(), size, name));
 
-        if (g_context->debug)
+        if (g_context->debug && !g_context->debugLineTablesOnly)
         {
             auto file = location.GetFile().debugFile;
             auto debugLocalVariable =
@@ -479,60 +517,128 @@ void VariableDefinitionAST::Codegen() const
             g_context->builder->CreateStore(initialValueCodegenned, FindVariable(name, location)->GetValue());
         }
     }
+    else if (currentPartition.has_value() && !currentPartition->definesGlobals)
+    {
+        // Globals are defined by one partition, the others only refer to them
+        auto global =
+            new llvm::GlobalVariable(*g_context->module, type->GetType(), isConst, llvm::GlobalValue::ExternalLinkage, nullptr, name);
+        global->setVisibility(llvm::GlobalValue::HiddenVisibility);
+        blockStack.back()[name] = MakeRef<VariableInfoGlobal>(global);
+    }
     else
     {
-        auto global = new llvm::GlobalVariable(
-            *g_context->module,
-            type->GetType(),
-            isConst,
-            llvm::GlobalValue::ExternalLinkage,
-            initialValue ? initialValue->EvaluateAsConstant() : type->GetDefaultValue(),
-            name);
+        auto initializer = initialValue ? initialValue->EvaluateAsConstant() : type->GetDefaultValue();
+        if (initialValue && is<IntegerType>(type))
+            initializer = llvm::ConstantFoldIntegerCast(
+                initializer, type->GetType(), as<IntegerType>(initialValue->GetType())->isSigned, g_context->module->getDataLayout());
+
+        auto linkage = currentPartition.has_value() ? llvm::GlobalValue::ExternalLinkage : llvm::GlobalValue::InternalLinkage;
+        auto global = new llvm::GlobalVariable(*g_context->module, type->GetType(), isConst, linkage, initializer, name);
+        if (currentPartition.has_value())
+            global->setVisibility(llvm::GlobalValue::HiddenVisibility);
         blockStack.back()[name] = MakeRef<VariableInfoGlobal>(global);
 
-        if (g_context->debug)
+        if (g_context->debug && !g_context->debugLineTablesOnly)
         {
             auto file = location.GetFile().debugFile;
-            auto debug = g_context->debugBuilder->createGlobalVariableExpression(
-                GetCurrentScope(), name, "", file, location.line, type->GetDebugType(), false);
+            global->addDebugInfo(g_context->debugBuilder->createGlobalVariableExpression(
+                GetCurrentScope(), name, "", file, location.line, type->GetDebugType(), true));
         }
     }
 }
 
-llvm::Function* FunctionAST::Codegen() const
+llvm::Function* FunctionAST::CodegenDeclaration() const
 {
-    EmitLocation();
-    assert(!isInsideFunction);
-
-    isInsideFunction = true;
-
     std::vector<llvm::Type*> llvmParams;
-    std::vector<llvm::Metadata*> debugTypes;
-
-    if (g_context->debug)
-        debugTypes.push_back(returnType->GetDebugType());
-
     for (const auto& param : params)
-    {
         llvmParams.push_back(param.type->GetType());
-        if (g_context->debug)
-            debugTypes.push_back(param.type->GetDebugType());
-    }
 
     auto functionType = llvm::FunctionType::get(returnType->GetType(), llvmParams, false);
-    auto function = llvm::Function::Create(functionType, llvm::Function::ExternalLinkage, name, g_context->module.get());
+    // Only main, the exports of a module and functions defined outside of Neon have to be visible to the linker
+    // NOTE: Partitions are internalized after they are linked together
+    bool isInternal = block != nullptr && name != "main" && !exported && !IsCompilerRuntime();
+    auto linkage = isInternal && !currentPartition.has_value() ? llvm::Function::InternalLinkage : llvm::Function::ExternalLinkage;
+    auto function = llvm::Function::Create(functionType, linkage, name, g_context->module.get());
+    // NOTE: Partitions of a cached build are never internalized, they still shouldn't be exported from the executable
+    if (isInternal && currentPartition.has_value())
+        function->setVisibility(llvm::GlobalValue::HiddenVisibility);
+    function->addFnAttr("target-cpu", g_context->targetMachine->getTargetCPU());
+    if (!g_context->targetMachine->getTargetFeatureString().empty())
+        function->addFnAttr("target-features", g_context->targetMachine->getTargetFeatureString());
+
+    // Neon has no exceptions, and nothing we call can unwind through us
+    function->setDoesNotThrow();
+
+    if (g_context->framePointers)
+        function->addFnAttr("frame-pointer", "all");
+    if (g_context->unwindTables)
+        function->setUWTableKind(llvm::UWTableKind::Async);
+
+    // NOTE: Without libc, LLVM mustn't turn our loops into calls to memcpy or strlen, which may not exist or be the loop
+    if (g_context->freestanding)
+        function->addFnAttr("no-builtins");
+
+    if (block != nullptr || imported)
+    {
+        function->setMemoryEffects(memoryEffects);
+        if (!isRecursive)
+            function->setDoesNotRecurse();
+        if (willReturn)
+            function->setWillReturn();
+    }
+
     for (auto& arg : function->args())
     {
         auto param = params[arg.getArgNo()];
-        if (is<StructType>(param.type) && !param.type->isRef)
-            arg.addAttr(llvm::Attribute::getWithByValType(*g_context->llvmContext, as<StructType>(param.type)->GetUnderlayingType()));
+        if (!is<StructType>(param.type))
+            continue;
+
+        auto structType = as<StructType>(param.type)->GetUnderlayingType();
+        if (!param.type->isRef)
+        {
+            arg.addAttr(llvm::Attribute::getWithByValType(*g_context->llvmContext, structType));
+            // The callee gets its own copy of the struct
+            arg.addAttr(llvm::Attribute::NoAlias);
+        }
+
+        arg.addAttr(llvm::Attribute::NonNull);
+        if (auto size = g_context->module->getDataLayout().getTypeAllocSize(structType); size != 0)
+            arg.addAttr(llvm::Attribute::getWithDereferenceableBytes(*g_context->llvmContext, size));
+
+        if (!param.isWritten)
+            arg.addAttr(llvm::Attribute::ReadOnly);
     }
 
     for (auto& param : function->args())
         param.setName(params[param.getArgNo()].name);
 
+    return function;
+}
+
+llvm::Function* FunctionAST::Codegen() const
+{
+    llvm::TimeTraceScope scope("CodegenFunction", name);
+
+    EmitLocation();
+    assert(!isInsideFunction);
+
+    isInsideFunction = true;
+
+    auto function = g_context->module->getFunction(name);
+    if (!function)
+        function = CodegenDeclaration();
+
+    std::vector<llvm::Metadata*> debugTypes;
+    if (g_context->debug && !g_context->debugLineTablesOnly)
+    {
+        debugTypes.push_back(returnType->GetDebugType());
+        for (const auto& param : params)
+            debugTypes.push_back(param.type->GetDebugType());
+    }
+
+    // NOTE: Declarations can't have a subprogram that claims to be a definition
     llvm::DISubprogram* debugFunction;
-    if (g_context->debug)
+    if (g_context->debug && block != nullptr)
     {
         auto file = location.GetFile().debugFile;
         debugFunction = g_context->debugBuilder->createFunction(
@@ -553,6 +659,10 @@ llvm::Function* FunctionAST::Codegen() const
 
     if (block != nullptr)
     {
+        // NOTE: Every module of a freestanding program has its own copy, the linker picks one
+        if (IsCompilerRuntime())
+            function->setLinkage(llvm::Function::WeakAnyLinkage);
+
         blockStack.push_back({});
 
         auto basicBlock = llvm::BasicBlock::Create(*g_context->llvmContext, "entry", function);
@@ -561,14 +671,16 @@ llvm::Function* FunctionAST::Codegen() const
         for (auto& arg : function->args())
         {
             // FIXME: Array support
-            auto alloca = g_context->builder->CreateAlloca(arg.getType(), 0, arg.getName());
-            blockStack.back()[arg.getName().str()] = MakeRef<VariableInfoAlloca>(alloca);
+            // NOTE: Value names might be discarded, so the name has to come from the AST
+            const auto& paramName = params.at(arg.getArgNo()).name;
+            auto alloca = g_context->builder->CreateAlloca(arg.getType(), 0, paramName);
+            blockStack.back()[paramName] = MakeRef<VariableInfoAlloca>(alloca);
 
-            if (g_context->debug)
+            if (g_context->debug && !g_context->debugLineTablesOnly)
             {
                 auto debugLocalVariable = g_context->debugBuilder->createParameterVariable(
                     debugFunction,
-                    arg.getName(),
+                    paramName,
                     arg.getArgNo() + 1,
                     location.GetFile().debugFile,
                     location.line,
@@ -590,15 +702,10 @@ llvm::Function* FunctionAST::Codegen() const
         if (is<VoidType>(returnType))
             g_context->builder->CreateRetVoid();
 
-        llvm::verifyFunction(*function);
-
-        if (g_context->optimize)
-            g_context->functionPassManager->run(*function, *g_context->functionAnalysisManager);
-
         blockStack.pop_back();
     }
 
-    if (g_context->debug)
+    if (g_context->debug && block != nullptr)
         debugScopes.pop_back();
 
     isInsideFunction = false;
@@ -608,6 +715,7 @@ llvm::Function* FunctionAST::Codegen() const
 
 void ParsedFile::Codegen() const
 {
+    ResetCodegenState();
     blockStack.push_back({});
 
     for (const auto& variable : globalVariables)
@@ -619,10 +727,122 @@ void ParsedFile::Codegen() const
     if (g_context->debug)
         g_context->debugBuilder->finalize();
 
-    llvm::verifyModule(*g_context->module);
+    blockStack.pop_back();
+
+    assert(blockStack.size() == 0);
+    assert(!isInsideFunction);
+}
+
+void ParsedFile::CodegenPartition(bool definesGlobals, const std::vector<Ref<FunctionAST>>& definedFunctions) const
+{
+    ResetCodegenState();
+    currentPartition = Partition{definesGlobals};
+    blockStack.push_back({});
+
+    for (const auto& variable : globalVariables)
+        variable->Codegen();
+
+    // Every partition only declares what its share of the functions calls, declaring every function in
+    // every partition would make splitting a big program quadratic
+    std::set<std::string> callees;
+    for (const auto& function : definedFunctions)
+        callees.insert(function->callees.begin(), function->callees.end());
+
+    for (const auto& function : functions)
+    {
+        if (callees.contains(function->name))
+            function->CodegenDeclaration();
+    }
+
+    for (const auto& function : definedFunctions)
+        function->Codegen();
+
+    if (g_context->debug)
+        g_context->debugBuilder->finalize();
 
     blockStack.pop_back();
+    currentPartition.reset();
 
     assert(blockStack.size() == 0);
     assert(!isInsideFunction);
 }
+
+void ParsedFile::ParallelCodegen(uint32_t jobs) const
+{
+    // Modules can't be moved between LLVM contexts, so the partitions are passed back as bitcode
+    auto parentContext = g_context;
+    auto parsedFile = g_parsedFile;
+    auto tracing = llvm::timeTraceProfilerEnabled();
+    std::vector<std::vector<Ref<FunctionAST>>> definedFunctions(jobs);
+    uint32_t definedCount = 0;
+    for (const auto& function : functions)
+    {
+        if (function->block)
+            definedFunctions[definedCount++ % jobs].push_back(function);
+    }
+
+    std::vector<llvm::SmallVector<char, 0>> partitions(jobs);
+    std::vector<std::exception_ptr> errors(jobs);
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < jobs; i++)
+    {
+        workers.emplace_back(
+            [&, i]
+            {
+                ThreadTimeTrace threadTrace(tracing);
+                g_parsedFile = parsedFile;
+                g_context = MakeRef<Context>(*parentContext, std::format("{}.{}", parentContext->module->getName().str(), i));
+                g_context->CopyStructsFrom(*parentContext);
+
+                try
+                {
+                    CodegenPartition(i == 0, definedFunctions[i]);
+                    g_context->Optimize(Context::OptimizationPhase::PreLink);
+
+                    llvm::raw_svector_ostream stream(partitions[i]);
+                    llvm::WriteBitcodeToFile(*g_context->module, stream);
+                }
+                catch (const CompileError&)
+                {
+                    errors[i] = std::current_exception();
+                }
+
+                g_context = nullptr;
+                g_parsedFile = nullptr;
+            });
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+
+    for (const auto& error : errors)
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    llvm::Linker linker(*g_context->module);
+    for (uint32_t i = 0; i < jobs; i++)
+    {
+        auto buffer = llvm::MemoryBufferRef(llvm::StringRef(partitions[i].data(), partitions[i].size()), std::format("partition{}", i));
+        auto partition = llvm::parseBitcodeFile(buffer, *g_context->llvmContext);
+        if (!partition)
+            g_context->Error({}, "COMPILER ERROR: Can't read back partition {}: {}", i, llvm::toString(partition.takeError()));
+
+        if (linker.linkInModule(std::move(partition.get())))
+            g_context->Error({}, "COMPILER ERROR: Can't link partition {}", i);
+    }
+
+    // Now that everything is in one module, the same things as in a single threaded build can be internal
+    for (const auto& variable : globalVariables)
+        g_context->module->getNamedGlobal(variable->name)->setLinkage(llvm::GlobalValue::InternalLinkage);
+
+    for (const auto& function : functions)
+    {
+        if (function->block && function->name != "main" && !function->exported && !function->IsCompilerRuntime())
+            g_context->module->getFunction(function->name)->setLinkage(llvm::GlobalValue::InternalLinkage);
+    }
+
+    if (g_context->debug)
+        g_context->debugBuilder->finalize();
+}
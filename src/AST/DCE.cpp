@@ -54,8 +54,32 @@ void ReturnStatementAST::DCE() const
         value->DCE();
 }
 
-void BlockAST::DCE() const
+// Whether the expression can be dropped when its value isn't used
+[[nodiscard]] static bool IsRemovable(const Ref<ExpressionAST>& expression)
 {
+    if (auto* binary = as_if<BinaryExpressionAST>(expression))
+        return binary->binaryOperation != BinaryOperation::Assignment && IsRemovable(binary->lhs) && IsRemovable(binary->rhs);
+    if (auto* call = as_if<CallExpressionAST>(expression))
+    {
+        auto callee = g_parsedFile->FindFunction(call->calleeName);
+        if (!callee->willReturn || !callee->memoryEffects.onlyReadsMemory())
+            return false;
+
+        return std::all_of(call->args.begin(), call->args.end(), IsRemovable);
+    }
+    if (auto* cast = as_if<CastExpressionAST>(expression))
+        return IsRemovable(cast->child);
+    if (auto* arrayAccess = as_if<ArrayAccessExpressionAST>(expression))
+        return IsRemovable(arrayAccess->index);
+    return true;
+}
+
+void BlockAST::DCE()
+{
+    std::erase_if(statements, [](const ExpressionOrStatement& statement) {
+        return std::holds_alternative<Ref<ExpressionAST>>(statement) && IsRemovable(std::get<Ref<ExpressionAST>>(statement));
+    });
+
     for (const auto& statement : statements)
     {
         if (std::holds_alternative<Ref<StatementAST>>(statement))
@@ -108,7 +132,21 @@ void ParsedFile::DCE()
         for (const auto& variable : globalVariables)
             variable->DCE();
 
-        FindFunction("main")->used = true;
+        // NOTE: A module has no main, everything it exports is used by its importers instead
+        if (auto main = FindFunction("main"))
+            main->used = true;
+
+        for (const auto& function : functions)
+        {
+            if (function->exported || function->IsCompilerRuntime())
+                function->used = true;
+        }
+
+        for (const auto& variable : globalVariables)
+        {
+            if (variable->exported)
+                variable->used = true;
+        }
 
         std::vector<Ref<FunctionAST>> functionsCopy = functions;
         functions.clear();
@@ -113,6 +113,7 @@ void FunctionAST::Dump(uint32_t indentCount) const
 {
     dump("Function (`{}`)", indentCount, name);
     dump("Return Type: {}", indentCount + 1, returnType->Dump());
+    dump("Purity: {}", indentCount + 1, GetPurity());
     for (const auto& param : params)
         dump("Param ('{}', {})", indentCount + 1, param.name, param.type->Dump());
 
@@ -0,0 +1,378 @@
+#include <AST.h>
+
+enum class EffectsVariableKind
+{
+    Local,
+    Param,
+    Global,
+};
+
+struct EffectsVariable
+{
+    EffectsVariableKind kind;
+    uint32_t paramIndex;
+};
+
+static thread_local std::vector<std::map<std::string, EffectsVariable>> blockStack;
+[[nodiscard]] static EffectsVariable FindVariable(const std::string& name)
+{
+    for (int i = blockStack.size() - 1; i >= 0; i--)
+    {
+        const auto& block = blockStack.at(i);
+        if (block.contains(name))
+            return block.at(name);
+    }
+
+    g_context->Error({}, "COMPILER ERROR: Variable {} not found at effect inference stage, this is a typechecker bug", name);
+}
+
+static thread_local llvm::MemoryEffects currentEffects;
+static thread_local std::set<std::string> currentCallees;
+static thread_local std::set<uint32_t> currentWrittenParams;
+static thread_local bool currentHasLoop;
+
+// Memory behind a pointer can be anything the caller can see, but never the callee's own stack
+static void AccessThroughPointer(llvm::ModRefInfo modRef)
+{
+    currentEffects |= llvm::MemoryEffects::argMemOnly(modRef) | llvm::MemoryEffects(llvm::IRMemLocation::Other, modRef);
+}
+
+static void AccessVariable(const std::string& name, llvm::ModRefInfo modRef)
+{
+    if (FindVariable(name).kind != EffectsVariableKind::Global)
+        return;
+
+    if (g_parsedFile->FindGlobalVariable(name)->isConst)
+        return;
+
+    currentEffects |= llvm::MemoryEffects(llvm::IRMemLocation::Other, modRef);
+}
+
+// Structs are passed by pointer, so members of a struct parameter live in the caller's memory
+static void AccessStructMember(const ExpressionAST& object, llvm::ModRefInfo modRef)
+{
+    auto* varExpr = as_if<VariableExpressionAST>(object);
+    if (!varExpr)
+        return;
+
+    auto variable = FindVariable(varExpr->name);
+    if (variable.kind == EffectsVariableKind::Param)
+    {
+        currentEffects |= llvm::MemoryEffects::argMemOnly(modRef);
+        if (llvm::isModSet(modRef))
+            currentWrittenParams.insert(variable.paramIndex);
+    }
+    else if (variable.kind == EffectsVariableKind::Global)
+    {
+        AccessVariable(varExpr->name, llvm::ModRefInfo::Ref);
+        AccessThroughPointer(modRef);
+    }
+}
+
+void NumberExpressionAST::InferEffects() const
+{
+}
+
+void VariableExpressionAST::InferEffects() const
+{
+    AccessVariable(name, llvm::ModRefInfo::Ref);
+}
+
+void StringLiteralAST::InferEffects() const
+{
+}
+
+void BinaryExpressionAST::InferEffects() const
+{
+    rhs->InferEffects();
+
+    if (binaryOperation != BinaryOperation::Assignment)
+    {
+        lhs->InferEffects();
+        return;
+    }
+
+    if (auto* var = as_if<VariableExpressionAST>(lhs))
+    {
+        AccessVariable(var->name, llvm::ModRefInfo::Mod);
+    }
+    else if (auto* array = as_if<ArrayAccessExpressionAST>(lhs))
+    {
+        array->index->InferEffects();
+        if (is<PointerType>(array->array->GetType()))
+        {
+            array->array->InferEffects();
+            AccessThroughPointer(llvm::ModRefInfo::Mod);
+        }
+        else
+        {
+            AccessVariable(array->array->name, llvm::ModRefInfo::Mod);
+        }
+    }
+    else if (auto* deref = as_if<DereferenceExpressionAST>(lhs))
+    {
+        deref->pointer->InferEffects();
+        AccessThroughPointer(llvm::ModRefInfo::Mod);
+    }
+    else if (auto* access = as_if<MemberAccessExpressionAST>(lhs))
+    {
+        AccessStructMember(*access->object, llvm::ModRefInfo::Mod);
+    }
+
+    // The assignment evaluates to the new value of the left hand side
+    lhs->InferEffects();
+}
+
+void CallExpressionAST::InferEffects() const
+{
+    currentCallees.insert(calleeName);
+
+    auto callee = g_parsedFile->FindFunction(calleeName);
+    assert(callee);
+
+    // What the callee does to its arguments has to be mapped to what we pass it, the rest applies to us as is
+    currentEffects |= callee->memoryEffects.getWithoutLoc(llvm::IRMemLocation::ArgMem);
+    auto argumentsModRef = callee->memoryEffects.getModRef(llvm::IRMemLocation::ArgMem);
+
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        args[i]->InferEffects();
+
+        const auto& param = callee->params[i];
+        if (is<StructType>(param.type) && param.type->isRef)
+            AccessStructMember(*args[i], param.isWritten ? argumentsModRef : argumentsModRef & llvm::ModRefInfo::Ref);
+        else if (is<StructType>(param.type))
+            AccessStructMember(*args[i], llvm::ModRefInfo::Ref); // The callee gets a copy made at the call site
+        else if (is<PointerType>(param.type))
+            AccessThroughPointer(argumentsModRef);
+    }
+}
+
+void CastExpressionAST::InferEffects() const
+{
+    child->InferEffects();
+}
+
+void ArrayAccessExpressionAST::InferEffects() const
+{
+    array->InferEffects();
+    index->InferEffects();
+
+    if (is<PointerType>(array->GetType()))
+        AccessThroughPointer(llvm::ModRefInfo::Ref);
+}
+
+void DereferenceExpressionAST::InferEffects() const
+{
+    pointer->InferEffects();
+    AccessThroughPointer(llvm::ModRefInfo::Ref);
+}
+
+void MemberAccessExpressionAST::InferEffects() const
+{
+    AccessStructMember(*object, llvm::ModRefInfo::Ref);
+}
+
+void ReturnStatementAST::InferEffects() const
+{
+    if (value)
+        value->InferEffects();
+}
+
+void BlockAST::InferEffects() const
+{
+    blockStack.push_back({});
+
+    for (const auto& statement : statements)
+    {
+        if (std::holds_alternative<Ref<StatementAST>>(statement))
+            std::get<Ref<StatementAST>>(statement)->InferEffects();
+        else
+            std::get<Ref<ExpressionAST>>(statement)->InferEffects();
+    }
+
+    blockStack.pop_back();
+}
+
+void IfStatementAST::InferEffects() const
+{
+    condition->InferEffects();
+    block->InferEffects();
+    if (elseBlock)
+        elseBlock->InferEffects();
+}
+
+void WhileStatementAST::InferEffects() const
+{
+    currentHasLoop = true;
+    condition->InferEffects();
+    block->InferEffects();
+}
+
+void VariableDefinitionAST::InferEffects() const
+{
+    if (initialValue)
+        initialValue->InferEffects();
+
+    blockStack.back()[name] = {EffectsVariableKind::Local, 0};
+}
+
+void FunctionAST::InferEffects() const
+{
+    if (!block)
+        return;
+
+    blockStack.push_back({});
+
+    for (uint32_t i = 0; i < params.size(); i++)
+        blockStack.back()[params[i].name] = {EffectsVariableKind::Param, i};
+
+    block->InferEffects();
+
+    blockStack.pop_back();
+}
+
+[[nodiscard]] static bool CanReach(const Ref<FunctionAST>& from, const std::string& to, std::set<std::string>& visited)
+{
+    for (const auto& calleeName : from->callees)
+    {
+        if (calleeName == to)
+            return true;
+
+        if (visited.contains(calleeName))
+            continue;
+        visited.insert(calleeName);
+
+        auto callee = g_parsedFile->FindFunction(calleeName);
+        if (callee && CanReach(callee, to, visited))
+            return true;
+    }
+
+    return false;
+}
+
+FunctionPurity FunctionAST::GetPurity() const
+{
+    if (memoryEffects.doesNotAccessMemory())
+        return FunctionPurity::Pure;
+    if (memoryEffects.onlyReadsMemory())
+        return FunctionPurity::ReadOnly;
+    if (memoryEffects.getWithoutLoc(llvm::IRMemLocation::ArgMem).onlyReadsMemory())
+        return FunctionPurity::WritesArgsOnly;
+    return FunctionPurity::SideEffecting;
+}
+
+void ParsedFile::InferEffects()
+{
+    // NOTE: A compilation on this thread that stopped at an error can leave its state behind
+    blockStack.clear();
+    blockStack.push_back({});
+
+    for (const auto& variable : globalVariables)
+        blockStack.back()[variable->name] = {EffectsVariableKind::Global, 0};
+
+    // Extern functions and plain syscalls can do anything, everything else starts out as pure
+    // and only gets less pure as the effects of its callees are propagated
+    // NOTE: Functions imported from a module keep the effects its interface has for them
+    for (const auto& function : functions)
+    {
+        if (function->imported)
+            continue;
+
+        if (function->block)
+            function->memoryEffects = llvm::MemoryEffects::none();
+        else
+            function->memoryEffects = g_context->GetSyscallMemoryEffects(function->name).value_or(llvm::MemoryEffects::unknown());
+        for (auto& param : function->params)
+            param.isWritten = !function->block;
+    }
+
+    std::set<std::string> functionsWithLoops;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+
+        for (const auto& function : functions)
+        {
+            if (!function->block)
+                continue;
+
+            currentEffects = llvm::MemoryEffects::none();
+            currentCallees.clear();
+            currentWrittenParams.clear();
+            currentHasLoop = false;
+
+            function->InferEffects();
+
+            function->callees = currentCallees;
+            if (currentHasLoop)
+                functionsWithLoops.insert(function->name);
+
+            if (currentEffects != function->memoryEffects)
+            {
+                function->memoryEffects = currentEffects;
+                changed = true;
+            }
+
+            for (uint32_t i = 0; i < function->params.size(); i++)
+            {
+                if (!function->params[i].isWritten && currentWrittenParams.contains(i))
+                {
+                    function->params[i].isWritten = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for (const auto& function : functions)
+    {
+        if (!function->block)
+            continue;
+
+        std::set<std::string> visited;
+        function->isRecursive = CanReach(function, function->name, visited);
+
+        // NOTE: main and the exports of a module are the only functions visible outside of it,
+        //       so external code (but not syscalls or other modules) can call back into them
+        if ((function->name == "main" || function->exported) && !function->isRecursive)
+        {
+            for (const auto& other : functions)
+            {
+                if (!other->block && !other->imported && !g_context->GetSyscallMemoryEffects(other->name) &&
+                    visited.contains(other->name))
+                    function->isRecursive = true;
+            }
+        }
+
+        // NOTE: We can't tell if a loop terminates
+        function->willReturn = !function->isRecursive && !functionsWithLoops.contains(function->name);
+    }
+
+    changed = true;
+    while (changed)
+    {
+        changed = false;
+
+        for (const auto& function : functions)
+        {
+            if (!function->willReturn)
+                continue;
+
+            for (const auto& calleeName : function->callees)
+            {
+                if (!FindFunction(calleeName)->willReturn)
+                {
+                    function->willReturn = false;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    blockStack.pop_back();
+
+    assert(blockStack.size() == 0);
+}
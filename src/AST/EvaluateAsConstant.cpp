@@ -1,23 +1,157 @@
 #include <AST.h>
+#include <llvm/Analysis/ConstantFolding.h>
 
-llvm::Constant* NumberExpressionAST::EvaluateAsConstant() const
+// Values of the parameters of the functions that are currently being evaluated
+static thread_local std::vector<std::map<std::string, llvm::Constant*>> constantBindings;
+
+[[nodiscard]] static llvm::Constant* IntegerCast(llvm::Constant* constant, llvm::Type* type, bool isSigned)
+{
+    return llvm::ConstantFoldIntegerCast(constant, type, isSigned, g_context->module->getDataLayout());
+}
+
+llvm::Constant* ExpressionAST::EvaluateAsConstant() const
+{
+    if (auto constant = TryEvaluateAsConstant())
+        return constant;
+
+    g_context->Error(location, "Expression is not constant");
+}
+
+llvm::Constant* NumberExpressionAST::TryEvaluateAsConstant() const
 {
     return llvm::ConstantInt::get(type->GetType(), llvm::APInt(type->bits, value, type->isSigned));
 }
 
-llvm::Constant* StringLiteralAST::EvaluateAsConstant() const
+llvm::Constant* VariableExpressionAST::TryEvaluateAsConstant() const
+{
+    if (!constantBindings.empty() && constantBindings.back().contains(name))
+        return constantBindings.back().at(name);
+
+    if (!isGlobal)
+        return nullptr;
+
+    auto variable = g_parsedFile->FindGlobalVariable(name);
+    if (!variable || !variable->isConst || !is<IntegerType>(variable->type))
+        return nullptr;
+
+    auto constant = variable->initialValue->TryEvaluateAsConstant();
+    if (!constant)
+        return nullptr;
+
+    return IntegerCast(constant, variable->type->GetType(), as<IntegerType>(variable->initialValue->GetType())->isSigned);
+}
+
+llvm::Constant* StringLiteralAST::TryEvaluateAsConstant() const
 {
-    // FIXME: Use createGlobalStringPtr
-    std::vector<llvm::Constant*> chars(value.size());
-    for (uint8_t i = 0; i < value.size(); i++)
-        chars[i] = llvm::ConstantInt::get(*g_context->llvmContext, llvm::APInt(8, value[i], true));
+    auto& rawString = g_context->stringLiteralData[value];
+    if (!rawString)
+    {
+        // NOTE: The null terminator isn't part of the string, but it makes the data usable from C
+        //       and lets the linker merge identical strings across objects
+        auto chars = llvm::ConstantDataArray::getString(*g_context->llvmContext, value, true);
+        rawString = new llvm::GlobalVariable(*g_context->module, chars->getType(), true, llvm::GlobalValue::PrivateLinkage, chars, ".str");
+        rawString->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+        rawString->setAlignment(llvm::Align(1));
+    }
 
-    auto charArray = llvm::ConstantArray::get(llvm::ArrayType::get(llvm::Type::getInt8Ty(*g_context->llvmContext), chars.size()), chars);
-    auto rawString = new llvm::GlobalVariable(*g_context->module, charArray->getType(), true, llvm::GlobalValue::PrivateLinkage, charArray);
-    auto stringStruct = llvm::ConstantStruct::get(
+    return llvm::ConstantStruct::get(
         g_context->structs.at("string").llvmType,
-        {llvm::ConstantExpr::getBitCast(rawString, llvm::Type::getInt8Ty(*g_context->llvmContext)->getPointerTo()),
-         llvm::ConstantInt::get(*g_context->llvmContext, llvm::APInt(64, value.size()))});
+        {rawString, llvm::ConstantInt::get(*g_context->llvmContext, llvm::APInt(64, value.size()))});
+}
+
+llvm::Constant* BinaryExpressionAST::TryEvaluateAsConstant() const
+{
+    static_assert(
+        static_cast<uint32_t>(BinaryOperation::_BinaryOperationCount) == 11,
+        "Not all binary operations are handled in BinaryExpressionAST::TryEvaluateAsConstant()");
+
+    if (binaryOperation == BinaryOperation::Assignment || !is<IntegerType>(lhs->GetType()) || !is<IntegerType>(rhs->GetType()))
+        return nullptr;
+
+    auto lhsConstant = lhs->TryEvaluateAsConstant();
+    auto rhsConstant = rhs->TryEvaluateAsConstant();
+    if (!lhsConstant || !rhsConstant)
+        return nullptr;
+
+    auto isLHSSigned = as<IntegerType>(lhs->GetType())->isSigned;
+    rhsConstant = IntegerCast(rhsConstant, lhsConstant->getType(), isLHSSigned);
+
+    using Predicate = llvm::CmpInst::Predicate;
+    const auto& dataLayout = g_context->module->getDataLayout();
+    auto binary = [&](llvm::Instruction::BinaryOps opcode) {
+        return llvm::ConstantFoldBinaryOpOperands(opcode, lhsConstant, rhsConstant, dataLayout);
+    };
+    auto compare = [&](Predicate predicate) {
+        return llvm::ConstantFoldCompareInstOperands(predicate, lhsConstant, rhsConstant, dataLayout);
+    };
+
+    llvm::Constant* result = nullptr;
+    switch (binaryOperation)
+    {
+        case BinaryOperation::Add:                result = binary(llvm::Instruction::Add); break;
+        case BinaryOperation::Subtract:           result = binary(llvm::Instruction::Sub); break;
+        case BinaryOperation::Multiply:           result = binary(llvm::Instruction::Mul); break;
+        case BinaryOperation::Divide:             result = binary(isLHSSigned ? llvm::Instruction::SDiv : llvm::Instruction::UDiv); break;
+        case BinaryOperation::Equals:             result = compare(Predicate::ICMP_EQ); break;
+        case BinaryOperation::NotEqual:           result = compare(Predicate::ICMP_NE); break;
+        case BinaryOperation::GreaterThan:        result = compare(isLHSSigned ? Predicate::ICMP_SGT : Predicate::ICMP_UGT); break;
+        case BinaryOperation::GreaterThanOrEqual: result = compare(isLHSSigned ? Predicate::ICMP_SGE : Predicate::ICMP_UGE); break;
+        case BinaryOperation::LessThan:           result = compare(isLHSSigned ? Predicate::ICMP_SLT : Predicate::ICMP_ULT); break;
+        case BinaryOperation::LessThanOrEqual:    result = compare(isLHSSigned ? Predicate::ICMP_SLE : Predicate::ICMP_ULE); break;
+        default:                                  assert(false);
+    }
+
+    // Things like division by zero fold to poison, leave those to the runtime
+    return llvm::isa_and_nonnull<llvm::ConstantInt>(result) ? result : nullptr;
+}
+
+llvm::Constant* CallExpressionAST::TryEvaluateAsConstant() const
+{
+    // Only calls to pure functions that are a single return statement can be evaluated for now
+    auto callee = g_parsedFile->FindFunction(calleeName);
+    if (!callee || !callee->block || callee->GetPurity() != FunctionPurity::Pure || !callee->willReturn ||
+        !is<IntegerType>(callee->returnType))
+        return nullptr;
+
+    if (callee->block->statements.size() != 1 || !std::holds_alternative<Ref<StatementAST>>(callee->block->statements[0]))
+        return nullptr;
+
+    auto* returnStatement = as_if<ReturnStatementAST>(std::get<Ref<StatementAST>>(callee->block->statements[0]));
+    if (!returnStatement)
+        return nullptr;
+
+    std::map<std::string, llvm::Constant*> bindings;
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        const auto& param = callee->params[i];
+        if (!is<IntegerType>(param.type) || !is<IntegerType>(args[i]->GetType()))
+            return nullptr;
+
+        auto constant = args[i]->TryEvaluateAsConstant();
+        if (!constant)
+            return nullptr;
+
+        bindings[param.name] = IntegerCast(constant, param.type->GetType(), as<IntegerType>(args[i]->GetType())->isSigned);
+    }
+
+    constantBindings.push_back(bindings);
+    auto result = returnStatement->value->TryEvaluateAsConstant();
+    constantBindings.pop_back();
+
+    if (!result)
+        return nullptr;
+
+    return IntegerCast(result, callee->returnType->GetType(), as<IntegerType>(returnStatement->value->GetType())->isSigned);
+}
+
+llvm::Constant* CastExpressionAST::TryEvaluateAsConstant() const
+{
+    if (!is<IntegerType>(child->GetType()) || !is<IntegerType>(castedTo))
+        return nullptr;
+
+    auto constant = child->TryEvaluateAsConstant();
+    if (!constant)
+        return nullptr;
 
-    return stringStruct;
+    return IntegerCast(constant, castedTo->GetType(), as<IntegerType>(child->GetType())->isSigned);
 }
@@ -0,0 +1,165 @@
+#include <AST.h>
+
+// Every node starts with its kind, so different trees can't hash the same by accident
+static void HashNode(StableHasher& hasher, std::string_view kind, const AST& node)
+{
+    hasher.add(kind);
+
+    // NOTE: Locations only end up in the generated code as debug info
+    if (g_context->debug && node.location.fileID.has_value())
+    {
+        hasher.add(g_context->files.at(*node.location.fileID).filename);
+        hasher.add(node.location.line);
+        hasher.add(node.location.column);
+    }
+}
+
+static void HashType(StableHasher& hasher, const Ref<Type>& type)
+{
+    hasher.add(type->Dump());
+    hasher.add(type->isRef);
+}
+
+void NumberExpressionAST::Hash(StableHasher& hasher) const
+{
+    HashNode(hasher, "Number", *this);
+    hasher.add(value);
+    HashType(hasher, type);
+}
+
+void VariableExpressionAST::Hash(StableHasher& hasher) const
+{
+    HashNode(hasher, "Variable", *this);
+    hasher.add(name);
+    HashType(hasher, type);
+    hasher.add(isGlobal);
+}
+
+void StringLiteralAST::Hash(StableHasher& hasher) const
+{
+    HashNode(hasher, "StringLiteral", *this);
+    hasher.add(value);
+}
+
+void BinaryExpressionAST::Hash(StableHasher& hasher) const
+{
+    HashNode(hasher, "Binary", *this);
+    hasher.add(static_cast<uint32_t>(binaryOperation));
+    lhs->Hash(hasher);
+    rhs->Hash(hasher);
+}
+
+void CallExpressionAST::Hash(StableHasher& hasher) const
+{
+    HashNode(hasher, "Call", *this);
+    hasher.add(calleeName);
+    hasher.add(args.size());
+    for (const auto& arg : args)
+        arg->Hash(hasher);
+}
+
+void CastExpressionAST::Hash(StableHasher& hasher) const
+{
+    HashNode(hasher, "Cast", *this);
+    HashType(hasher, castedTo);
+    child->Hash(hasher);
+}
+
+void ArrayAccessExpressionAST::Hash(StableHasher& hasher) const
+{
+    HashNode(hasher, "ArrayAccess", *this);
+    array->Hash(hasher);
+    index->Hash(hasher);
+}
+
+void DereferenceExpressionAST::Hash(StableHasher& hasher) const
+{
+    HashNode(hasher, "Dereference", *this);
+    pointer->Hash(hasher);
+}
+
+void MemberAccessExpressionAST::Hash(StableHasher& hasher) const
+{
+    HashNode(hasher, "MemberAccess", *this);
+    hasher.add(memberName);
+    object->Hash(hasher);
+}
+
+void ReturnStatementAST::Hash(StableHasher& hasher) const
+{
+    HashNode(hasher, "Return", *this);
+    hasher.add(value != nullptr);
+    if (value != nullptr)
+        value->Hash(hasher);
+}
+
+void BlockAST::Hash(StableHasher& hasher) const
+{
+    HashNode(hasher, "Block", *this);
+    hasher.add(statements.size());
+
+    for (const auto& statement : statements)
+    {
+        if (std::holds_alternative<Ref<StatementAST>>(statement))
+            std::get<Ref<StatementAST>>(statement)->Hash(hasher);
+        else
+            std::get<Ref<ExpressionAST>>(statement)->Hash(hasher);
+    }
+}
+
+void IfStatementAST::Hash(StableHasher& hasher) const
+{
+    HashNode(hasher, "If", *this);
+    condition->Hash(hasher);
+    block->Hash(hasher);
+    hasher.add(elseBlock != nullptr);
+    if (elseBlock != nullptr)
+        elseBlock->Hash(hasher);
+}
+
+void WhileStatementAST::Hash(StableHasher& hasher) const
+{
+    HashNode(hasher, "While", *this);
+    condition->Hash(hasher);
+    block->Hash(hasher);
+}
+
+void VariableDefinitionAST::Hash(StableHasher& hasher) const
+{
+    HashNode(hasher, "VariableDefinition", *this);
+    hasher.add(name);
+    HashType(hasher, type);
+    hasher.add(isConst);
+    hasher.add(used);
+    hasher.add(initialValue != nullptr);
+    if (initialValue != nullptr)
+        initialValue->Hash(hasher);
+}
+
+void FunctionAST::HashSignature(StableHasher& hasher) const
+{
+    HashNode(hasher, "Function", *this);
+    hasher.add(name);
+    HashType(hasher, returnType);
+    hasher.add(params.size());
+    for (const auto& param : params)
+    {
+        hasher.add(param.name);
+        HashType(hasher, param.type);
+        hasher.add(param.isWritten);
+    }
+
+    // The results of effect inference become attributes of the function and of every call to it
+    hasher.add(memoryEffects.toIntValue());
+    hasher.add(isRecursive);
+    hasher.add(willReturn);
+}
+
+void FunctionAST::Hash(StableHasher& hasher) const
+{
+    HashSignature(hasher);
+
+    hasher.add(block != nullptr);
+    if (block != nullptr)
+        block->Hash(hasher);
+}
@@ -1,15 +1,19 @@
 #include "Type.h"
 #include <AST.h>
 #include <Context.h>
+#include <Timing.h>
 #include <TypeCasts.h>
+#include <exception>
 #include <llvm/IR/Type.h>
+#include <thread>
 
 struct VariableInfo
 {
     Ref<Type> type;
     bool isConst;
+    bool isGlobal;
 };
-static std::vector<std::map<std::string, VariableInfo>> blockStack;
+static thread_local std::vector<std::map<std::string, VariableInfo>> blockStack;
 [[nodiscard]] static VariableInfo FindVariable(const std::string& name, Location location)
 {
     for (int i = blockStack.size() - 1; i >= 0; i--)
@@ -22,15 +26,15 @@ static std::vector<std::map<std::string, VariableInfo>> blockStack;
     g_context->Error(location, "Can't find variable: {}", name);
 }
 
-static std::string typecheckCurrentFunction;
-static bool foundMain = false;
+static thread_local std::string typecheckCurrentFunction;
+static thread_local bool foundMain = false;
 
 struct TypecheckFunction
 {
     std::vector<Ref<Type>> params;
     Ref<Type> returnType;
 };
-static std::map<std::string, TypecheckFunction> typecheckFunctions;
+static thread_local std::map<std::string, TypecheckFunction> typecheckFunctions;
 
 void NumberExpressionAST::Typecheck()
 {
@@ -38,7 +42,9 @@ void NumberExpressionAST::Typecheck()
 
 void VariableExpressionAST::Typecheck()
 {
-    type = FindVariable(name, location).type;
+    auto variable = FindVariable(name, location);
+    type = variable.type;
+    isGlobal = variable.isGlobal;
 }
 
 void StringLiteralAST::Typecheck()
@@ -127,7 +133,7 @@ void MemberAccessExpressionAST::Typecheck()
         g_context->Error(location, "Can't access member of non-struct type: {}", object->GetType()->ReadableName());
 
     auto structType = as<StructType>(object->GetType());
-    for (const auto& [memberName, memberType] : g_context->structs[structType->name].members)
+    for (const auto& [memberName, memberType] : g_context->structs.at(structType->name).members)
     {
         if (memberName == this->memberName)
         {
@@ -203,7 +209,7 @@ void VariableDefinitionAST::Typecheck()
             number->AdjustType(StaticRefCast<IntegerType>(type));
     }
 
-    blockStack.back()[name] = {type, isConst};
+    blockStack.back()[name] = {type, isConst, blockStack.size() == 1};
 }
 
 void FunctionAST::Typecheck()
@@ -211,10 +217,12 @@ void FunctionAST::Typecheck()
     assert(name != "");
     assert(returnType);
 
+    llvm::TimeTraceScope scope("TypecheckFunction", name);
+
     typecheckCurrentFunction = name;
     blockStack.push_back({});
 
-    blockStack.back()[name] = {returnType, false};
+    blockStack.back()[name] = {returnType, false, false};
 
     std::vector<Ref<Type>> typecheckParams;
     for (const auto& param : params)
@@ -223,7 +231,7 @@ void FunctionAST::Typecheck()
 
         param.type->Typecheck(location);
 
-        blockStack.back()[param.name] = {param.type, false};
+        blockStack.back()[param.name] = {param.type, false, false};
     }
 
     returnType->Typecheck(location);
@@ -267,9 +275,13 @@ void FunctionAST::Typecheck()
     typecheckCurrentFunction = "";
 }
 
-void ParsedFile::Typecheck()
+// NOTE: A compilation on this thread that stopped at an error can leave its state behind
+static void ResetTypecheckState()
 {
-    blockStack.push_back({});
+    blockStack.clear();
+    typecheckCurrentFunction.clear();
+    foundMain = false;
+    typecheckFunctions.clear();
 
     auto int64 = MakeRef<IntegerType>(64, false);
     typecheckFunctions["syscall0"] = {.params = {int64}, .returnType = int64};
@@ -279,6 +291,13 @@ void ParsedFile::Typecheck()
     typecheckFunctions["syscall4"] = {.params = {int64, int64, int64, int64, int64}, .returnType = int64};
     typecheckFunctions["syscall5"] = {.params = {int64, int64, int64, int64, int64, int64}, .returnType = int64};
     typecheckFunctions["syscall6"] = {.params = {int64, int64, int64, int64, int64, int64, int64}, .returnType = int64};
+}
+
+void ParsedFile::Typecheck()
+{
+    ResetTypecheckState();
+
+    blockStack.push_back({});
 
     for (const auto& variable : globalVariables)
         variable->Typecheck();
@@ -286,7 +305,80 @@ void ParsedFile::Typecheck()
     for (const auto& function : functions)
         function->Typecheck();
 
-    if (!foundMain)
+    if (!foundMain && !g_context->compilingModule)
+        g_context->Error({}, "No main function found");
+
+    blockStack.pop_back();
+
+    assert(blockStack.size() == 0);
+}
+
+void ParsedFile::Typecheck(const std::vector<std::vector<Ref<FunctionAST>>>& sourceFunctions)
+{
+    ResetTypecheckState();
+
+    blockStack.push_back({});
+
+    for (const auto& variable : globalVariables)
+        variable->Typecheck();
+
+    // Sources can call each other, so every signature is known before any body is checked
+    auto globals = blockStack.back();
+    auto signatures = typecheckFunctions;
+    for (const auto& function : functions)
+    {
+        std::vector<Ref<Type>> params;
+        for (const auto& param : function->params)
+            params.push_back(param.type);
+
+        signatures[function->name] = {.params = params, .returnType = function->returnType};
+    }
+
+    // NOTE: Typechecking only reads the context, so the threads share it
+    auto context = g_context;
+    auto parsedFile = g_parsedFile;
+    auto tracing = llvm::timeTraceProfilerEnabled();
+    std::vector<std::exception_ptr> errors(sourceFunctions.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < sourceFunctions.size(); i++)
+    {
+        workers.emplace_back(
+            [&, i]
+            {
+                ThreadTimeTrace threadTrace(tracing);
+                g_context = context;
+                g_parsedFile = parsedFile;
+
+                ResetTypecheckState();
+                typecheckFunctions = signatures;
+                blockStack.push_back(globals);
+
+                try
+                {
+                    for (const auto& function : sourceFunctions[i])
+                        function->Typecheck();
+                }
+                catch (const CompileError&)
+                {
+                    errors[i] = std::current_exception();
+                }
+
+                blockStack.clear();
+                g_context = nullptr;
+                g_parsedFile = nullptr;
+            });
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+
+    for (const auto& error : errors)
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    if (!FindFunction("main") && !g_context->compilingModule)
         g_context->Error({}, "No main function found");
 
     blockStack.pop_back();
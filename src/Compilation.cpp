@@ -0,0 +1,436 @@
+#include <Compilation.h>
+#include <Interface.h>
+#include <Lexer.h>
+#include <Parser.h>
+#include <Preprocessor.h>
+#include <Timing.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <llvm/ADT/ScopeExit.h>
+#include <thread>
+#include <unistd.h>
+
+// Small enough that a batch's IR is never much, big enough that creating its context doesn't dominate
+static constexpr size_t streamingBatchSize = 64;
+
+Compilation::Compilation(Ref<Context> context, const std::vector<std::string>& otherSources)
+    : context(std::move(context))
+{
+    g_context = this->context;
+    g_parsedFile = nullptr;
+
+    sourceFileIDs.push_back(this->context->rootFileID);
+    for (const auto& filename : otherSources)
+        sourceFileIDs.push_back(this->context->LoadFile(filename));
+}
+
+bool Compilation::Run(const std::function<void()>& step)
+{
+    g_context = context;
+    g_parsedFile = parsedFile;
+
+    try
+    {
+        step();
+        return true;
+    }
+    catch (const CompileError& error)
+    {
+        errors.push_back(error);
+        return false;
+    }
+}
+
+bool Compilation::Parse(bool dce)
+{
+    return Run(
+        [&]
+        {
+            if (sourceFileIDs.size() > 1)
+            {
+                ParseSources();
+            }
+            else
+            {
+                // NOTE: Emplacing the next phase stops the timer of the one before it
+                std::optional<PhaseTimer> timer;
+                timer.emplace("CreateTokenStream");
+                auto tokenStream = CreateTokenStream(context->rootFileID);
+
+                timer.emplace("Preprocess");
+                tokenStream = Preprocess(std::move(tokenStream));
+
+                timer.emplace("Parse");
+                Parser parser(std::move(tokenStream));
+                parsedFile = parser.Parse();
+                g_parsedFile = parsedFile;
+
+                timer.emplace("Typecheck");
+                parsedFile->Typecheck();
+            }
+
+            if (context->compilingModule)
+                MarkExports();
+
+            {
+                PhaseTimer timer("InferEffects");
+                parsedFile->InferEffects();
+            }
+
+            if (dce)
+            {
+                PhaseTimer timer("DCE");
+                parsedFile->DCE();
+            }
+        });
+}
+
+void Compilation::ParseSources()
+{
+    // Parsing adds structs (which are LLVM types) to the context, so every thread has its own
+    auto sourceCount = sourceFileIDs.size();
+    auto moduleName = context->module->getName().str();
+    auto tracing = llvm::timeTraceProfilerEnabled();
+    std::vector<Ref<Context>> sourceContexts(sourceCount);
+    std::vector<Ref<ParsedFile>> sourceFiles(sourceCount);
+    std::vector<std::exception_ptr> sourceErrors(sourceCount);
+    std::vector<std::thread> workers;
+    std::optional<PhaseTimer> timer;
+    timer.emplace("Parse");
+    for (size_t i = 0; i < sourceCount; i++)
+    {
+        workers.emplace_back(
+            [&, i]
+            {
+                ThreadTimeTrace threadTrace(tracing);
+                g_context = MakeRef<Context>(*context, std::format("{}.{}", moduleName, i));
+                g_context->nextFileID = context->nextFileID + i;
+                g_context->fileIDStride = sourceCount;
+                sourceContexts[i] = g_context;
+
+                try
+                {
+                    llvm::TimeTraceScope scope("ParseSource", g_context->files.at(sourceFileIDs[i]).filename);
+                    Parser parser(Preprocess(CreateTokenStream(sourceFileIDs[i])));
+                    sourceFiles[i] = parser.Parse();
+                }
+                catch (const CompileError&)
+                {
+                    sourceErrors[i] = std::current_exception();
+                }
+
+                g_context = nullptr;
+            });
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+
+    for (const auto& error : sourceErrors)
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    timer.emplace("Merge");
+    auto sourceFunctions = Merge(sourceContexts, sourceFiles);
+    g_parsedFile = parsedFile;
+
+    timer.emplace("Typecheck");
+    parsedFile->Typecheck(sourceFunctions);
+}
+
+// Every source includes the Prelude, so the same definition can come from several of them
+[[nodiscard]] static bool SameDefinition(Location location, Location otherLocation)
+{
+    return location.GetFile().filename == otherLocation.GetFile().filename && location.line == otherLocation.line &&
+           location.column == otherLocation.column;
+}
+
+[[nodiscard]] static bool SameSignature(const FunctionAST& function, const FunctionAST& other)
+{
+    if (function.params.size() != other.params.size() || *function.returnType != *other.returnType)
+        return false;
+
+    for (size_t i = 0; i < function.params.size(); i++)
+    {
+        if (*function.params[i].type != *other.params[i].type)
+            return false;
+    }
+
+    return true;
+}
+
+std::vector<std::vector<Ref<FunctionAST>>> Compilation::Merge(
+    const std::vector<Ref<Context>>& sourceContexts, const std::vector<Ref<ParsedFile>>& sourceFiles)
+{
+    for (const auto& sourceContext : sourceContexts)
+    {
+        for (auto [fileID, fileInfo] : sourceContext->files)
+        {
+            if (context->files.contains(fileID))
+                continue;
+
+            fileInfo.debugFile = context->debug ? context->debugBuilder->createFile(fileInfo.filename, ".") : nullptr;
+            context->files[fileID] = std::move(fileInfo);
+            context->nextFileID = std::max(context->nextFileID, fileID + 1);
+        }
+    }
+
+    // NOTE: A source's structs are in the order it defined them, so members always refer to structs that are already added
+    for (const auto& sourceContext : sourceContexts)
+    {
+        for (const auto& name : sourceContext->structOrder)
+        {
+            const auto& info = sourceContext->structs.at(name);
+            if (auto existing = context->structs.find(name); existing != context->structs.end())
+            {
+                if (!SameDefinition(info.location, existing->second.location))
+                    context->Error(info.location, "Struct {} is already defined in {}", name, existing->second.location.GetFile().filename);
+
+                continue;
+            }
+
+            context->AddStruct(name, info.members, info.location);
+        }
+    }
+
+    // Declarations (extern functions) are resolved to the definition in another source
+    std::vector<Ref<FunctionAST>> functions;
+    std::map<std::string, size_t> functionIndices;
+    std::vector<Ref<VariableDefinitionAST>> globalVariables;
+    std::map<std::string, Ref<VariableDefinitionAST>> globalsByName;
+    for (const auto& sourceFile : sourceFiles)
+    {
+        for (const auto& function : sourceFile->functions)
+        {
+            auto [index, inserted] = functionIndices.try_emplace(function->name, functions.size());
+            if (inserted)
+            {
+                functions.push_back(function);
+                continue;
+            }
+
+            auto& existing = functions[index->second];
+            if (SameDefinition(function->location, existing->location))
+                continue;
+
+            if (function->block && existing->block)
+                context->Error(
+                    function->location, "Function {} is already defined in {}", function->name, existing->location.GetFile().filename);
+
+            if (!SameSignature(*function, *existing))
+                context->Error(
+                    function->location,
+                    "Function {} doesn't match its declaration in {}",
+                    function->name,
+                    existing->location.GetFile().filename);
+
+            if (function->block)
+                existing = function;
+        }
+
+        for (const auto& variable : sourceFile->globalVariables)
+        {
+            auto [existing, inserted] = globalsByName.try_emplace(variable->name, variable);
+            if (inserted)
+                globalVariables.push_back(variable);
+            else if (!SameDefinition(variable->location, existing->second->location))
+                context->Error(
+                    variable->location,
+                    "Global variable {} is already defined in {}",
+                    variable->name,
+                    existing->second->location.GetFile().filename);
+        }
+    }
+
+    parsedFile = MakeRef<ParsedFile>(functions, globalVariables);
+
+    // Functions from a file several sources include are typechecked by the first of them
+    std::vector<std::vector<Ref<FunctionAST>>> sourceFunctions(sourceFiles.size());
+    for (size_t i = 0; i < sourceFiles.size(); i++)
+    {
+        for (const auto& function : sourceFiles[i]->functions)
+        {
+            if (functions[functionIndices.at(function->name)] == function)
+                sourceFunctions[i].push_back(function);
+        }
+    }
+
+    return sourceFunctions;
+}
+
+void Compilation::MarkExports()
+{
+    auto isSource = [&](Location location) { return std::ranges::contains(sourceFileIDs, location.fileID.value()); };
+
+    for (const auto& function : parsedFile->functions)
+        function->exported = function->block && isSource(function->location);
+
+    for (const auto& variable : parsedFile->globalVariables)
+        variable->exported = variable->isConst && is<IntegerType>(variable->type) && isSource(variable->location);
+}
+
+bool Compilation::Generate(uint32_t jobs, bool verify)
+{
+    return Run(
+        [&]
+        {
+            std::optional<PhaseTimer> timer;
+            timer.emplace("Codegen");
+            if (jobs > 1)
+                parsedFile->ParallelCodegen(jobs);
+            else
+                parsedFile->Codegen();
+
+            timer.emplace("Finalize");
+            context->Finalize();
+
+            if (verify)
+            {
+                timer.emplace("Verify");
+                context->Verify();
+            }
+
+            timer.emplace("Optimize");
+            context->Optimize(jobs > 1 ? Context::OptimizationPhase::PostLink : Context::OptimizationPhase::Full);
+        });
+}
+
+bool Compilation::WriteInterface(const std::string& filename)
+{
+    return Run([&] { ::WriteInterface(filename); });
+}
+
+std::optional<std::string> Compilation::Write(
+    Context::OutputFileType fileType, std::optional<std::string> outputLocation, const std::vector<std::string>& linkInputs, uint32_t jobs)
+{
+    std::optional<std::string> outputFilename;
+    Run(
+        [&]
+        {
+            PhaseTimer timer("Write");
+            outputFilename = context->Write(fileType, outputLocation, linkInputs, jobs);
+        });
+    return outputFilename;
+}
+
+std::optional<std::string> Compilation::WriteStreaming(
+    std::optional<std::string> outputLocation, const std::vector<std::string>& linkInputs, uint32_t jobs, bool verify)
+{
+    std::optional<std::string> outputFilename;
+    Run(
+        [&]
+        {
+            auto main = parsedFile->FindFunction("main");
+            if (!main || !main->block)
+                context->Error({}, "No main function found");
+
+            // The globals are the first batch, like with the object cache
+            std::vector<std::vector<Ref<FunctionAST>>> batches(1);
+            for (const auto& function : parsedFile->functions)
+            {
+                if (!function->block)
+                    continue;
+
+                if (batches.size() == 1 || batches.back().size() == streamingBatchSize)
+                    batches.emplace_back();
+                batches.back().push_back(function);
+            }
+
+            auto moduleName = context->module->getName().str();
+            auto tracing = llvm::timeTraceProfilerEnabled();
+            std::optional<PhaseTimer> timer;
+            timer.emplace("CodegenBatches");
+            // NOTE: Every batch is emitted straight to a file, so no object stays in memory until the link
+            std::vector<int> objectFDs(batches.size(), -1);
+            auto closeObjects = llvm::make_scope_exit(
+                [&]
+                {
+                    for (int fd : objectFDs)
+                    {
+                        if (fd >= 0)
+                            close(fd);
+                    }
+                });
+
+            std::atomic<size_t> nextBatch = 0;
+            std::vector<std::exception_ptr> batchErrors(batches.size());
+            std::vector<std::thread> workers;
+            for (size_t i = 0; i < std::min<size_t>(jobs, batches.size()); i++)
+            {
+                workers.emplace_back(
+                    [&]
+                    {
+                        ThreadTimeTrace threadTrace(tracing);
+                        g_parsedFile = parsedFile;
+                        for (auto batch = nextBatch++; batch < batches.size(); batch = nextBatch++)
+                        {
+                            g_context = MakeRef<Context>(*context, std::format("{}.{}", moduleName, batch));
+                            g_context->CopyStructsFrom(*context);
+
+                            try
+                            {
+                                parsedFile->CodegenPartition(batch == 0, batches[batch]);
+                                g_context->Finalize();
+
+                                if (verify)
+                                    g_context->Verify();
+
+                                g_context->Optimize();
+
+                                objectFDs[batch] = context->CreateObjectFile();
+                                llvm::raw_fd_ostream stream(objectFDs[batch], false);
+                                g_context->Emit(stream, llvm::CodeGenFileType::ObjectFile);
+
+                                // NOTE: The stream aborts the process if it's destroyed with an error it didn't report
+                                stream.flush();
+                                if (auto error = stream.error())
+                                {
+                                    stream.clear_error();
+                                    context->Error({}, "Can't write the object of a batch: {}", error.message());
+                                }
+                            }
+                            catch (const CompileError&)
+                            {
+                                batchErrors[batch] = std::current_exception();
+                            }
+
+                            g_context = nullptr;
+
+                            // NOTE: The blocks stay, they tell declarations in later batches that the functions are defined
+                            //       Pure functions keep their bodies, so calls to them can still be evaluated at compile time
+                            for (const auto& function : batches[batch])
+                            {
+                                if (function->GetPurity() != FunctionPurity::Pure)
+                                    function->block->statements = {};
+                            }
+                        }
+
+                        g_parsedFile = nullptr;
+                    });
+            }
+
+            for (auto& worker : workers)
+                worker.join();
+
+            for (const auto& error : batchErrors)
+            {
+                if (error)
+                    std::rethrow_exception(error);
+            }
+
+            timer.emplace("Link");
+            outputFilename = context->OutputFilename(Context::OutputFileType::Executable, outputLocation);
+            std::vector<std::string> inputs;
+            for (int fd : objectFDs)
+                inputs.push_back(std::format("/proc/self/fd/{}", fd));
+            std::ranges::copy(linkInputs, std::back_inserter(inputs));
+
+            context->Link({}, inputs, *outputFilename, jobs);
+        });
+
+    return outputFilename;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <AST.h>
+#include <functional>
+
+// A program being compiled, the entry point for using the compiler as a library
+// NOTE: The passes find the program they're working on through g_context and g_parsedFile, which every thread has
+//       its own of. Every call makes the compilation current on the calling thread, so separate threads can compile
+//       separate programs at the same time
+struct Compilation
+{
+    // The context holds the options and the root file, its constructor throws CompileError if either is bad
+    // The other sources are compiled into the same program, and throw CompileError here if they can't be loaded
+    // NOTE: Context::sources can provide any file (including the ones in lib/) from memory
+    explicit Compilation(Ref<Context> context, const std::vector<std::string>& otherSources = {});
+
+    Ref<Context> context;
+    Ref<ParsedFile> parsedFile;
+    std::vector<uint32_t> sourceFileIDs; // The root file first
+
+    std::vector<CompileError> errors;
+
+    // Every step returns false when the program has an error, which is added to `errors`
+
+    // Lexes, preprocesses, parses, typechecks, infers effects and eliminates dead code
+    // With more than one source, each is parsed and typechecked on its own thread
+    bool Parse(bool dce = true);
+
+    // Generates and optimizes the IR, on `jobs` threads
+    bool Generate(uint32_t jobs = 1, bool verify = false);
+
+    // Writes the interface of a module (see Interface.h), after it's parsed
+    bool WriteInterface(const std::string& filename);
+
+    // Returns the name of the written file
+    std::optional<std::string> Write(
+        Context::OutputFileType fileType,
+        std::optional<std::string> outputLocation,
+        const std::vector<std::string>& linkInputs = {},
+        uint32_t jobs = 1);
+
+    // Generates, optimizes and emits the program a batch of functions at a time on `jobs` threads, and links the objects into
+    // an executable. Every batch's IR and the bodies of its functions are freed once it's an object in a temporary file, so
+    // the memory used doesn't grow with the size of the program like with Generate (which builds one module) and Write
+    std::optional<std::string> WriteStreaming(
+        std::optional<std::string> outputLocation, const std::vector<std::string>& linkInputs = {}, uint32_t jobs = 1, bool verify = false);
+
+private:
+    bool Run(const std::function<void()>& step);
+
+    void ParseSources();
+
+    // When compiling a module, everything its sources define is exported, but not what they include
+    void MarkExports();
+
+    // Puts the parsed sources together into `parsedFile`, returns the functions each source has to typecheck
+    std::vector<std::vector<Ref<FunctionAST>>> Merge(
+        const std::vector<Ref<Context>>& sourceContexts, const std::vector<Ref<ParsedFile>>& sourceFiles);
+};
@@ -1,33 +1,78 @@
 #include <Context.h>
+#include <Timing.h>
 
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
 #include <filesystem>
+#include <mutex>
+#include <lld/Common/Driver.h>
+#include <llvm/Analysis/ModuleSummaryAnalysis.h>
+#include <llvm/Analysis/ProfileSummaryInfo.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/CodeGen/ParallelCG.h>
+#include <llvm/Config/llvm-config.h>
 #include <llvm/IR/InlineAsm.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/MC/TargetRegistry.h>
+#include <llvm/Object/ELFObjectFile.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/VersionTuple.h>
 #include <llvm/TargetParser/Host.h>
-#include <llvm/Transforms/InstCombine/InstCombine.h>
-#include <llvm/Transforms/Scalar.h>
-#include <llvm/Transforms/Scalar/DCE.h>
-#include <llvm/Transforms/Scalar/GVN.h>
-#include <llvm/Transforms/Scalar/Reassociate.h>
-#include <llvm/Transforms/Scalar/SimplifyCFG.h>
-#include <llvm/Transforms/Utils.h>
-#include <llvm/Transforms/Utils/Mem2Reg.h>
+#include <llvm/TargetParser/SubtargetFeature.h>
+#include <llvm/TargetParser/Triple.h>
 #include <stdarg.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/wait.h>
+#include <unistd.h>
+#include <utility>
 
-Ref<Context> g_context;
+LLD_HAS_DRIVER(elf)
 
-uint32_t lastFileID = 0;
+thread_local Ref<Context> g_context;
 
-Context::Context(const std::string& baseFile, std::optional<std::string> passedTarget, bool optimize, bool debug)
-    : optimize(optimize)
-    , debug(debug)
+static llvm::CodeGenOptLevel CodeGenOptLevelFromOptimizationLevel(llvm::OptimizationLevel optimizationLevel)
+{
+    switch (optimizationLevel.getSpeedupLevel())
+    {
+        case 0:  return llvm::CodeGenOptLevel::None;
+        case 1:  return llvm::CodeGenOptLevel::Less;
+        case 2:  return llvm::CodeGenOptLevel::Default;
+        default: return llvm::CodeGenOptLevel::Aggressive;
+    }
+}
+
+void Context::InitializeTargets()
+{
+    static std::once_flag initialized;
+    std::call_once(
+        initialized,
+        []
+        {
+            llvm::InitializeAllTargetInfos();
+            llvm::InitializeAllTargets();
+            llvm::InitializeAllTargetMCs();
+            llvm::InitializeAllAsmParsers();
+            llvm::InitializeAllAsmPrinters();
+        });
+}
+
+Context::Context(const std::string& baseFile, const ContextOptions& options, std::map<std::string, std::string> sources)
+    : optimizationLevel(options.optimizationLevel)
+    , pgoOptions(options.pgoOptions)
+    , thinLTO(options.thinLTO)
+    , debug(options.debug)
+    , debugLineTablesOnly(options.debugLineTablesOnly)
+    , freestanding(options.freestanding)
+    , framePointers(options.framePointers)
+    , unwindTables(options.unwindTables)
+    , sources(std::move(sources))
 {
     llvmContext = MakeOwn<llvm::LLVMContext>();
+    // NOTE: Names only make the IR readable, LLVM has to keep them unique which costs time
+    llvmContext->setDiscardValueNames(options.discardValueNames);
     module = MakeOwn<llvm::Module>(baseFile, *llvmContext);
     builder = MakeOwn<llvm::IRBuilder<>>(*llvmContext);
 
@@ -37,62 +82,58 @@ Context::Context(const std::string& baseFile, std::optional<std::string> passedT
     rootFileID = LoadFile(baseFile);
 
     if (debug)
-        debugCompileUnit = debugBuilder->createCompileUnit(
-            llvm::dwarf::DW_LANG_C, debugBuilder->createFile(files.at(rootFileID).filename, "."), "Neon", false, "", 0);
-
-    if (optimize)
-    {
-        functionPassManager = MakeOwn<llvm::FunctionPassManager>();
-        loopAnalysisManager = MakeOwn<llvm::LoopAnalysisManager>();
-        functionAnalysisManager = MakeOwn<llvm::FunctionAnalysisManager>();
-        cgsccAnalysisManager = MakeOwn<llvm::CGSCCAnalysisManager>();
-        moduleAnalysisManager = MakeOwn<llvm::ModuleAnalysisManager>();
-        passInstrumentationCallbacks = MakeOwn<llvm::PassInstrumentationCallbacks>();
-        standardInstrumentations = MakeOwn<llvm::StandardInstrumentations>(*llvmContext, true);
-        standardInstrumentations->registerCallbacks(*passInstrumentationCallbacks, moduleAnalysisManager.get());
-
-        functionPassManager->addPass(llvm::PromotePass());
-        functionPassManager->addPass(llvm::DCEPass());
-        functionPassManager->addPass(llvm::InstCombinePass());
-        functionPassManager->addPass(llvm::ReassociatePass());
-        functionPassManager->addPass(llvm::GVNPass());
-        functionPassManager->addPass(llvm::SimplifyCFGPass());
-
-        llvm::PassBuilder passBuilder;
-        passBuilder.registerModuleAnalyses(*moduleAnalysisManager);
-        passBuilder.registerFunctionAnalyses(*functionAnalysisManager);
-        passBuilder.crossRegisterProxies(*loopAnalysisManager, *functionAnalysisManager, *cgsccAnalysisManager, *moduleAnalysisManager);
-    }
+        CreateDebugCompileUnit();
 
-    auto targetTriple = passedTarget.has_value() ? passedTarget.value() : llvm::sys::getDefaultTargetTriple();
+    auto targetTriple = options.target.value_or(llvm::sys::getDefaultTargetTriple());
 
-    llvm::InitializeAllTargetInfos();
-    llvm::InitializeAllTargets();
-    llvm::InitializeAllTargetMCs();
-    llvm::InitializeAllAsmParsers();
-    llvm::InitializeAllAsmPrinters();
+    InitializeTargets();
 
     std::string error;
     auto target = llvm::TargetRegistry::lookupTarget(targetTriple, error);
 
     if (!target)
+        Error({}, "Error loading target {}: {}", targetTriple, error);
+
+    auto cpu = options.cpu.value_or("generic");
+    auto features = options.features.value_or("");
+
+    if (cpu == "native")
     {
-        std::println(std::cerr, "Error loading target {}: {}", targetTriple, error);
-        exit(1);
+        if (llvm::Triple(targetTriple).getArch() != llvm::Triple(llvm::sys::getDefaultTargetTriple()).getArch())
+            Error({}, "Can't target the native CPU when compiling for {}", targetTriple);
+
+        cpu = llvm::sys::getHostCPUName().str();
+
+        llvm::SubtargetFeatures hostFeatures;
+        for (const auto& feature : llvm::sys::getHostCPUFeatures())
+            hostFeatures.AddFeature(feature.getKey(), feature.getValue());
+
+        // NOTE: Features passed explicitly come last, so they override the detected ones
+        features = features.empty() ? hostFeatures.getString() : hostFeatures.getString() + "," + features;
     }
 
-    targetMachine = target->createTargetMachine(targetTriple, "generic", "", {}, {});
+    // Without optimizations, instruction selection is most of the backend's time, so use the fast one
+    // NOTE: Targets that prefer GlobalISel without optimizations (like AArch64) keep using it
+    auto targetOptions = options.targetOptions;
+    if (optimizationLevel == llvm::OptimizationLevel::O0)
+        targetOptions.EnableFastISel = true;
+
+    targetMachine = Own<llvm::TargetMachine>(target->createTargetMachine(
+        targetTriple, cpu, features, targetOptions, {}, {}, CodeGenOptLevelFromOptimizationLevel(optimizationLevel)));
 
     module->setDataLayout(targetMachine->createDataLayout());
     module->setTargetTriple(targetTriple);
 
+    // NOTE: The function attributes are what codegen looks at, these are for functions LLVM creates itself
+    if (framePointers)
+        module->setFramePointer(llvm::FramePointerKind::All);
+    if (unwindTables)
+        module->setUwtable(llvm::UWTableKind::Async);
+
     std::string arch = targetMachine->getTarget().getName();
 
     if (targetMachine->getPointerSizeInBits(0) != 64)
-    {
-        std::println(std::cerr, "Unsupported pointer size: {}", targetMachine->getPointerSizeInBits(0));
-        exit(1);
-    }
+        Error({}, "Unsupported pointer size: {}", targetMachine->getPointerSizeInBits(0));
 
     if (arch == "x86-64")
     {
@@ -106,12 +147,102 @@ Context::Context(const std::string& baseFile, std::optional<std::string> passedT
     {
         std::println(std::cerr, "Unsupported architecture: {}, not enabling syscalls or preprocessor arch directives!", arch);
     }
+
+    defines.push_back(freestanding ? "FREESTANDING" : "HOSTED");
 }
 
-void Context::CreateSyscall(uint32_t number, std::string mnemonic, std::string returnRegister, std::string registers)
+Context::Context(const Context& parent, const std::string& moduleName)
+    : optimizationLevel(parent.optimizationLevel)
+    , pgoOptions(parent.pgoOptions)
+    , thinLTO(parent.thinLTO)
+    , debug(parent.debug)
+    , debugLineTablesOnly(parent.debugLineTablesOnly)
+    , freestanding(parent.freestanding)
+    , framePointers(parent.framePointers)
+    , unwindTables(parent.unwindTables)
+    , rootFileID(parent.rootFileID)
+    , nextFileID(parent.nextFileID)
+    , files(parent.files)
+    , sources(parent.sources)
+    , importPaths(parent.importPaths)
+    , defines(parent.defines)
 {
-    if (auto function = module->getFunction(std::string("syscall") + std::to_string(number)))
+    llvmContext = MakeOwn<llvm::LLVMContext>();
+    llvmContext->setDiscardValueNames(parent.llvmContext->shouldDiscardValueNames());
+    module = MakeOwn<llvm::Module>(moduleName, *llvmContext);
+    builder = MakeOwn<llvm::IRBuilder<>>(*llvmContext);
+
+    targetMachine = parent.CreateTargetMachine();
+
+    module->setDataLayout(parent.module->getDataLayout());
+    module->setTargetTriple(parent.module->getTargetTriple());
+
+    if (framePointers)
+        module->setFramePointer(llvm::FramePointerKind::All);
+    if (unwindTables)
+        module->setUwtable(llvm::UWTableKind::Async);
+
+    if (debug)
+    {
+        debugBuilder = MakeOwn<llvm::DIBuilder>(*module);
+
+        for (auto& [fileID, fileInfo] : files)
+            fileInfo.debugFile = debugBuilder->createFile(fileInfo.filename, ".");
+
+        CreateDebugCompileUnit();
+    }
+}
+
+void Context::CreateDebugCompileUnit()
+{
+    // NOTE: Without the version, debug info is stripped when a module is read back from bitcode
+    module->addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+
+    debugCompileUnit = debugBuilder->createCompileUnit(
+        llvm::dwarf::DW_LANG_C,
+        debugBuilder->createFile(files.at(rootFileID).filename, "."),
+        "Neon",
+        optimizationLevel != llvm::OptimizationLevel::O0,
+        "",
+        0,
+        "",
+        debugLineTablesOnly ? llvm::DICompileUnit::LineTablesOnly : llvm::DICompileUnit::FullDebug);
+}
+
+Own<llvm::TargetMachine> Context::CreateTargetMachine() const
+{
+    return Own<llvm::TargetMachine>(targetMachine->getTarget().createTargetMachine(
+        targetMachine->getTargetTriple().str(),
+        targetMachine->getTargetCPU(),
+        targetMachine->getTargetFeatureString(),
+        targetMachine->Options,
+        targetMachine->getRelocationModel(),
+        targetMachine->getCodeModel(),
+        targetMachine->getOptLevel()));
+}
+
+struct SyscallVariant
+{
+    std::string_view suffix;
+    llvm::MemoryEffects memoryEffects;
+};
+
+// syscallN can do anything, the variants are for syscalls that are known to only read user memory
+// (like write) or not touch it at all (like close), so the optimizer doesn't have to treat them as barriers
+static const SyscallVariant syscallVariants[] = {
+    {"", llvm::MemoryEffects::unknown()},
+    {"_readonly", llvm::MemoryEffects::readOnly() | llvm::MemoryEffects::inaccessibleMemOnly()},
+    {"_nomem", llvm::MemoryEffects::inaccessibleMemOnly()},
+};
+
+void Context::CreateSyscall(uint32_t number, std::string mnemonic, std::string returnRegister, std::string registers, std::string clobbers)
+{
+    for (const auto& variant : syscallVariants)
     {
+        auto function = module->getFunction(std::format("syscall{}{}", number, variant.suffix));
+        if (!function)
+            continue;
+
         std::vector<llvm::Value*> argsValues{};
         for (auto& arg : function->args())
             argsValues.push_back(&arg);
@@ -119,25 +250,98 @@ void Context::CreateSyscall(uint32_t number, std::string mnemonic, std::string r
         if (g_context->debugBuilder)
             g_context->builder->SetCurrentDebugLocation(llvm::DebugLoc());
 
+        // The stubs are tiny, so they always get inlined into the caller instead of costing a call
+        function->setLinkage(llvm::GlobalValue::InternalLinkage);
+        function->addFnAttr(llvm::Attribute::AlwaysInline);
+        function->setMemoryEffects(variant.memoryEffects);
+
         auto block = llvm::BasicBlock::Create(*llvmContext, "entry", function);
         builder->SetInsertPoint(block);
 
+        auto touchesUserMemory = !variant.memoryEffects.getWithoutLoc(llvm::IRMemLocation::InaccessibleMem).doesNotAccessMemory();
         auto inlineAsm = llvm::InlineAsm::get(
             function->getFunctionType(),
             mnemonic,
-            std::string("=") + returnRegister + "," + registers + ",~{memory},~{dirflag},~{fpsr},~{flags}",
+            std::string("=") + returnRegister + "," + registers + clobbers + (touchesUserMemory ? ",~{memory}" : "") +
+                ",~{dirflag},~{fpsr},~{flags}",
             true,
             true,
             llvm::InlineAsm::AsmDialect::AD_ATT,
             false);
         auto result = builder->CreateCall(inlineAsm, argsValues);
+        result->setMemoryEffects(variant.memoryEffects);
 
         builder->CreateRet(result);
+    }
+}
+
+std::optional<llvm::MemoryEffects> Context::GetSyscallMemoryEffects(const std::string& name) const
+{
+    for (uint32_t number = 0; number <= 6; number++)
+    {
+        for (const auto& variant : syscallVariants)
+        {
+            if (name == std::format("syscall{}{}", number, variant.suffix))
+                return variant.memoryEffects;
+        }
+    }
 
-        llvm::verifyFunction(*function);
+    return {};
+}
+
+void Context::AddStruct(const std::string& name, const std::map<std::string, Ref<Type>>& members, Location location)
+{
+    std::vector<llvm::Type*> llvmMembers;
+    std::vector<llvm::Metadata*> debugTypes;
+    uint64_t debugOffset = 0;
+    for (auto& [memberName, type] : members)
+    {
+        llvmMembers.push_back(type->GetType());
+        if (debug)
+        {
+            auto file = location.GetFile().debugFile;
+            auto size = module->getDataLayout().getTypeAllocSizeInBits(type->GetType());
+            debugTypes.push_back(debugBuilder->createMemberType(
+                file, memberName, file, location.line, size, 0, debugOffset, llvm::DINode::FlagZero, type->GetDebugType()));
+            debugOffset += size;
+        }
+    }
 
-        if (g_context->optimize)
-            g_context->functionPassManager->run(*function, *g_context->functionAnalysisManager);
+    if (llvmMembers.empty())
+    {
+        llvmMembers.push_back(llvm::Type::getInt8Ty(*llvmContext));
+        if (debug)
+            debugTypes.push_back(debugBuilder->createBasicType("uint8", 8, llvm::dwarf::DW_ATE_unsigned));
+    }
+
+    auto llvmType = llvm::StructType::create(*llvmContext, llvmMembers, name);
+
+    llvm::DICompositeType* debugType = nullptr;
+    if (debug)
+    {
+        auto file = location.GetFile().debugFile;
+        debugType = debugBuilder->createStructType(
+            file,
+            name,
+            file,
+            location.line,
+            module->getDataLayout().getTypeAllocSizeInBits(llvmType),
+            0,
+            llvm::DINode::FlagPrototyped,
+            nullptr,
+            debugBuilder->getOrCreateArray(debugTypes));
+    }
+
+    structs[name] = {.name = name, .members = members, .llvmType = llvmType, .debugType = debugType, .location = location};
+    structOrder.push_back(name);
+}
+
+void Context::CopyStructsFrom(const Context& other)
+{
+    for (const auto& name : other.structOrder)
+    {
+        const auto& info = other.structs.at(name);
+        AddStruct(name, info.members, info.location);
     }
 }
 
@@ -149,12 +353,33 @@ uint32_t Context::LoadFile(const std::string& filename)
             return fileID;
     }
 
-    uint32_t fileID = lastFileID++;
+    std::vector<char> content;
+    if (auto source = sources.find(filename); source != sources.end())
+        content.assign(source->second.begin(), source->second.end());
+    else if (std::filesystem::is_regular_file(filename))
+        content = ReadFile(filename);
+    else
+        Error({}, "Can't open file: {}", filename);
+
+    uint32_t fileID = nextFileID;
+    nextFileID += fileIDStride;
     auto debugFile = debug ? debugBuilder->createFile(filename, ".") : nullptr;
-    files[fileID] = {filename, ReadFile(filename), debugFile};
+    files[fileID] = {filename, std::move(content), debugFile};
     return fileID;
 }
 
+std::vector<std::string> Context::LoadedFilenames() const
+{
+    std::vector<std::string> filenames;
+    for (const auto& [fileID, fileInfo] : files)
+    {
+        if (std::ranges::find(filenames, fileInfo.filename) == filenames.end())
+            filenames.push_back(fileInfo.filename);
+    }
+
+    return filenames;
+}
+
 std::pair<uint32_t, uint32_t> Context::LineColumnFromLocation(uint32_t fileID, size_t index) const
 {
     uint32_t line = 1;
@@ -180,32 +405,389 @@ void Context::Finalize()
 {
     std::string arch = targetMachine->getTarget().getName();
 
+    // NOTE: With the object cache every function is its own module, _start goes next to main
+    auto* mainFunction = module->getFunction("main");
+    bool definesEntryPoint = freestanding && mainFunction && !mainFunction->isDeclaration();
+
     if (arch == "x86-64")
     {
-        CreateSyscall(0, "syscall", "{ax}", "{ax}");
-        CreateSyscall(1, "syscall", "{ax}", "{ax},{di}");
-        CreateSyscall(2, "syscall", "{ax}", "{ax},{di},{si}");
-        CreateSyscall(3, "syscall", "{ax}", "{ax},{di},{si},{dx}");
-        CreateSyscall(4, "syscall", "{ax}", "{ax},{di},{si},{dx},{r10}");
-        CreateSyscall(5, "syscall", "{ax}", "{ax},{di},{si},{dx},{r10},{r8}");
-        CreateSyscall(6, "syscall", "{ax}", "{ax},{di},{si},{dx},{r10},{r8},{r9}");
+        CreateSyscall(0, "syscall", "{ax}", "{ax}", ",~{rcx},~{r11}");
+        CreateSyscall(1, "syscall", "{ax}", "{ax},{di}", ",~{rcx},~{r11}");
+        CreateSyscall(2, "syscall", "{ax}", "{ax},{di},{si}", ",~{rcx},~{r11}");
+        CreateSyscall(3, "syscall", "{ax}", "{ax},{di},{si},{dx}", ",~{rcx},~{r11}");
+        CreateSyscall(4, "syscall", "{ax}", "{ax},{di},{si},{dx},{r10}", ",~{rcx},~{r11}");
+        CreateSyscall(5, "syscall", "{ax}", "{ax},{di},{si},{dx},{r10},{r8}", ",~{rcx},~{r11}");
+        CreateSyscall(6, "syscall", "{ax}", "{ax},{di},{si},{dx},{r10},{r8},{r9}", ",~{rcx},~{r11}");
+
+        // argc is on top of the stack with argv right after it, main's return value goes to exit_group
+        if (definesEntryPoint)
+            module->appendModuleInlineAsm(R"(
+                .globl _start
+                .type _start, @function
+                _start:
+                    xor %rbp, %rbp
+                    mov (%rsp), %rdi
+                    lea 8(%rsp), %rsi
+                    and $-16, %rsp
+                    call main
+                    mov %eax, %edi
+                    mov $231, %eax
+                    syscall
+            )");
     }
     else if (arch == "aarch64")
     {
-        CreateSyscall(0, "svc #0", "{x0}", "{x8}");
-        CreateSyscall(1, "svc #0", "{x0}", "{x8},{x0}");
-        CreateSyscall(2, "svc #0", "{x0}", "{x8},{x0},{x1}");
-        CreateSyscall(3, "svc #0", "{x0}", "{x8},{x0},{x1},{x2}");
-        CreateSyscall(4, "svc #0", "{x0}", "{x8},{x0},{x1},{x2},{x3}");
-        CreateSyscall(5, "svc #0", "{x0}", "{x8},{x0},{x1},{x2},{x3},{x4}");
-        CreateSyscall(6, "svc #0", "{x0}", "{x8},{x0},{x1},{x2},{x3},{x4},{x5}");
+        CreateSyscall(0, "svc #0", "{x0}", "{x8}", "");
+        CreateSyscall(1, "svc #0", "{x0}", "{x8},{x0}", "");
+        CreateSyscall(2, "svc #0", "{x0}", "{x8},{x0},{x1}", "");
+        CreateSyscall(3, "svc #0", "{x0}", "{x8},{x0},{x1},{x2}", "");
+        CreateSyscall(4, "svc #0", "{x0}", "{x8},{x0},{x1},{x2},{x3}", "");
+        CreateSyscall(5, "svc #0", "{x0}", "{x8},{x0},{x1},{x2},{x3},{x4}", "");
+        CreateSyscall(6, "svc #0", "{x0}", "{x8},{x0},{x1},{x2},{x3},{x4},{x5}", "");
+
+        if (definesEntryPoint)
+            module->appendModuleInlineAsm(R"(
+                .globl _start
+                .type _start, %function
+                _start:
+                    mov x29, #0
+                    mov x30, #0
+                    ldr x0, [sp]
+                    add x1, sp, #8
+                    bl main
+                    mov x8, #94
+                    svc #0
+            )");
+    }
+}
+
+void Context::Verify() const
+{
+    std::string errors;
+    llvm::raw_string_ostream errorStream(errors);
+    if (llvm::verifyModule(*module, &errorStream))
+        Error({}, "COMPILER ERROR: Generated invalid IR:\n{}", errors);
+}
+
+void Context::Optimize(OptimizationPhase phase)
+{
+    // Partitions get linked together as they are, the always inliner runs once afterwards
+    // NOTE: With ThinLTO, the merged module gets the ThinLTO pre-link pipeline instead
+    if (phase == OptimizationPhase::PreLink && (optimizationLevel == llvm::OptimizationLevel::O0 || thinLTO))
+        return;
+
+    // NOTE: The analyses registered by the pass builder refer back to it, so it has to outlive the analysis managers
+    llvm::PassInstrumentationCallbacks passInstrumentationCallbacks;
+    llvm::StandardInstrumentations standardInstrumentations(*llvmContext, false);
+    llvm::PassBuilder passBuilder(targetMachine.get(), llvm::PipelineTuningOptions(), pgoOptions, &passInstrumentationCallbacks);
+
+    llvm::LoopAnalysisManager loopAnalysisManager;
+    llvm::FunctionAnalysisManager functionAnalysisManager;
+    llvm::CGSCCAnalysisManager cgsccAnalysisManager;
+    llvm::ModuleAnalysisManager moduleAnalysisManager;
+
+    standardInstrumentations.registerCallbacks(passInstrumentationCallbacks, &moduleAnalysisManager);
+    PipelineTimer pipelineTimer(passInstrumentationCallbacks);
+
+    passBuilder.registerModuleAnalyses(moduleAnalysisManager);
+    passBuilder.registerCGSCCAnalyses(cgsccAnalysisManager);
+    passBuilder.registerFunctionAnalyses(functionAnalysisManager);
+    passBuilder.registerLoopAnalyses(loopAnalysisManager);
+    passBuilder.crossRegisterProxies(loopAnalysisManager, functionAnalysisManager, cgsccAnalysisManager, moduleAnalysisManager);
+
+    // NOTE: Even without optimizations we have to run the always inliner for the syscall stubs
+    llvm::ModulePassManager modulePassManager;
+    if (optimizationLevel == llvm::OptimizationLevel::O0)
+        modulePassManager = passBuilder.buildO0DefaultPipeline(optimizationLevel);
+    else if (thinLTO)
+        modulePassManager = passBuilder.buildThinLTOPreLinkDefaultPipeline(optimizationLevel);
+    else if (phase == OptimizationPhase::PreLink)
+        modulePassManager = passBuilder.buildLTOPreLinkDefaultPipeline(optimizationLevel);
+    else if (phase == OptimizationPhase::PostLink)
+        modulePassManager = passBuilder.buildLTODefaultPipeline(optimizationLevel, nullptr);
+    else
+        modulePassManager = passBuilder.buildPerModuleDefaultPipeline(optimizationLevel);
+    modulePassManager.run(*module, moduleAnalysisManager);
+}
+
+// The profile runtime comes with the LLVM we are built against, in either the per-target or the older per-OS layout
+static std::optional<std::filesystem::path> FindProfileRuntime(const llvm::Triple& triple)
+{
+    std::filesystem::path resourceDirectory = std::format("{}/clang/{}/lib", LLVM_LIBRARY_DIR, LLVM_VERSION_MAJOR);
+    std::filesystem::path candidates[] = {
+        resourceDirectory / triple.str() / "libclang_rt.profile.a",
+        resourceDirectory / "linux" / std::format("libclang_rt.profile-{}.a", triple.getArchName().str()),
+    };
+
+    for (const auto& candidate : candidates)
+    {
+        if (std::filesystem::exists(candidate))
+            return candidate;
     }
+
+    return {};
 }
 
-void Context::Write(OutputFileType fileType, std::optional<std::string> outputLocation, bool run) const
+// Looks in the places Debian-like (multiarch) and Fedora-like systems keep the C runtime
+static std::optional<std::filesystem::path> FindCRuntime(const llvm::Triple& triple)
 {
-    assert(!run || fileType == OutputFileType::Executable);
+    auto multiarch = std::format("{}-linux-gnu", triple.getArchName().str());
+    std::filesystem::path directories[] = {"/usr/lib/" + multiarch, "/lib/" + multiarch, "/usr/lib64", "/usr/lib"};
+    for (const auto& directory : directories)
+    {
+        if (std::filesystem::exists(directory / "crt1.o"))
+            return directory;
+    }
 
+    return {};
+}
+
+// crtbegin.o and crtend.o run the constructors and destructors of linked C code and define __dso_handle (for atexit),
+// the libraries have the helpers compilers call for what the target can't do in instructions
+struct CompilerRuntime
+{
+    std::string crtbegin;
+    std::string crtend;
+    std::vector<std::string> libraries;
+    std::vector<std::string> sharedLibraries; // Only for dynamically linked executables
+};
+
+// Prefers the newest GCC, like the gcc driver we linked with before, and falls back to the compiler-rt of our LLVM
+static std::optional<CompilerRuntime> FindCompilerRuntime(const llvm::Triple& triple)
+{
+    std::optional<std::filesystem::path> newestDirectory;
+    llvm::VersionTuple newestVersion;
+    for (const auto* gccDirectory : {"/usr/lib/gcc", "/usr/lib64/gcc"})
+    {
+        std::error_code errorCode;
+        for (const auto& targetDirectory : std::filesystem::directory_iterator(gccDirectory, errorCode))
+        {
+            if (!targetDirectory.path().filename().string().starts_with(triple.getArchName().str() + "-"))
+                continue;
+
+            for (const auto& versionDirectory : std::filesystem::directory_iterator(targetDirectory.path(), errorCode))
+            {
+                llvm::VersionTuple version;
+                if (version.tryParse(versionDirectory.path().filename().string()) ||
+                    !std::filesystem::exists(versionDirectory.path() / "crtbegin.o"))
+                    continue;
+
+                if (!newestDirectory || version > newestVersion)
+                {
+                    newestDirectory = versionDirectory.path();
+                    newestVersion = version;
+                }
+            }
+        }
+    }
+
+    if (newestDirectory)
+    {
+        return CompilerRuntime{
+            .crtbegin = (*newestDirectory / "crtbegin.o").string(),
+            .crtend = (*newestDirectory / "crtend.o").string(),
+            .libraries = {"-L" + newestDirectory->string(), "-lgcc"},
+            .sharedLibraries = {"--as-needed", "-lgcc_s", "--no-as-needed"},
+        };
+    }
+
+    std::filesystem::path resourceDirectory = std::format("{}/clang/{}/lib", LLVM_LIBRARY_DIR, LLVM_VERSION_MAJOR);
+    auto arch = triple.getArchName().str();
+    std::pair<std::filesystem::path, std::string> layouts[] = {
+        {resourceDirectory / triple.str(), ""},
+        {resourceDirectory / "linux", "-" + arch},
+    };
+
+    for (const auto& [directory, suffix] : layouts)
+    {
+        auto crtbegin = directory / std::format("clang_rt.crtbegin{}.o", suffix);
+        if (!std::filesystem::exists(crtbegin))
+            continue;
+
+        return CompilerRuntime{
+            .crtbegin = crtbegin.string(),
+            .crtend = (directory / std::format("clang_rt.crtend{}.o", suffix)).string(),
+            .libraries = {(directory / std::format("libclang_rt.builtins{}.a", suffix)).string()},
+        };
+    }
+
+    return {};
+}
+
+void Context::Link(
+    const std::vector<llvm::SmallVector<char, 0>>& objects,
+    const std::vector<std::string>& linkInputs,
+    const std::string& outputFilename,
+    uint32_t jobs) const
+{
+    const auto& triple = targetMachine->getTargetTriple();
+
+    // NOTE: LLD only takes paths, so the objects are passed as anonymous in-memory files
+    std::vector<int> objectFDs;
+    std::vector<std::string> objectPaths;
+    for (const auto& object : objects)
+    {
+        int fd = memfd_create("neon-object", MFD_CLOEXEC);
+        if (fd < 0 || write(fd, object.data(), object.size()) != static_cast<ssize_t>(object.size()))
+            Error({}, "Error passing object to the linker: {}", strerror(errno));
+
+        objectFDs.push_back(fd);
+        objectPaths.push_back(std::format("/proc/self/fd/{}", fd));
+    }
+
+    std::vector<const char*> args = {"ld.lld", "-o", outputFilename.c_str()};
+    for (const auto& objectPath : objectPaths)
+        args.push_back(objectPath.c_str());
+    for (const auto& linkInput : linkInputs)
+        args.push_back(linkInput.c_str());
+
+    // LLD runs LTO on its own whenever it gets bitcode, ours or clang's
+    auto ltoOptimizationLevel = std::format("--lto-O{}", optimizationLevel.getSpeedupLevel());
+    auto ltoJobs = std::format("--thinlto-jobs={}", jobs);
+    args.insert(args.end(), {ltoOptimizationLevel.c_str(), ltoJobs.c_str()});
+
+    // Everything has its own section, so whatever isn't referenced from the entry point can be dropped
+    if (targetMachine->Options.FunctionSections || targetMachine->Options.DataSections)
+        args.push_back("--gc-sections");
+
+    // Instrumented programs write their profile at exit through the profile runtime
+    // NOTE: On Linux nothing references the runtime, the driver is expected to pull it in
+    std::string profileRuntime;
+    if (pgoOptions.has_value() && pgoOptions->Action == llvm::PGOOptions::IRInstr)
+    {
+        if (freestanding)
+            Error({}, "Can't generate profiles for freestanding programs, the profile runtime needs libc");
+
+        auto runtime = FindProfileRuntime(triple);
+        if (!runtime)
+            Error({}, "Can't find the profile runtime for {}", triple.str());
+
+        profileRuntime = runtime->string();
+        args.insert(args.end(), {"-u", "__llvm_profile_runtime", profileRuntime.c_str()});
+    }
+
+    // Freestanding programs have everything they need, otherwise we have to bring in the C runtime and libc
+    // NOTE: Either way, linked C code can call into the compiler runtime
+    auto compilerRuntime = FindCompilerRuntime(triple);
+    std::string crt1, crti, crtn, libraryDirectory, dynamicLinker;
+    if (freestanding)
+    {
+        args.push_back("-static");
+        if (compilerRuntime)
+        {
+            for (const auto& library : compilerRuntime->libraries)
+                args.push_back(library.c_str());
+        }
+    }
+    else
+    {
+        auto runtimeDirectory = FindCRuntime(triple);
+        if (!runtimeDirectory)
+            Error({}, "Can't find the C runtime (crt1.o) for {}", triple.str());
+
+        if (triple.getArch() == llvm::Triple::x86_64)
+            dynamicLinker = "/lib64/ld-linux-x86-64.so.2";
+        else if (triple.getArch() == llvm::Triple::aarch64)
+            dynamicLinker = "/lib/ld-linux-aarch64.so.1";
+        else
+            Error({}, "Don't know how to link executables for {}", triple.str());
+
+        if (!compilerRuntime)
+            Error({}, "Can't find crtbegin.o from GCC or compiler-rt for {}", triple.str());
+
+        crt1 = (*runtimeDirectory / "crt1.o").string();
+        crti = (*runtimeDirectory / "crti.o").string();
+        crtn = (*runtimeDirectory / "crtn.o").string();
+        libraryDirectory = "-L" + runtimeDirectory->string();
+
+        args.insert(
+            args.begin() + 3, {"--dynamic-linker", dynamicLinker.c_str(), crt1.c_str(), crti.c_str(), compilerRuntime->crtbegin.c_str()});
+        args.insert(args.end(), {libraryDirectory.c_str(), "-lc"});
+        for (const auto& library : compilerRuntime->libraries)
+            args.push_back(library.c_str());
+        for (const auto& library : compilerRuntime->sharedLibraries)
+            args.push_back(library.c_str());
+        args.insert(args.end(), {compilerRuntime->crtend.c_str(), crtn.c_str()});
+    }
+
+    // NOTE: LLD keeps its state in globals, so links of compilations on separate threads take turns
+    //       After some errors that state can't be cleaned up, and every later link in this process would use it
+    static std::mutex linkerMutex;
+    static bool linkerCanRunAgain = true;
+    std::optional<lld::Result> result;
+    {
+        std::lock_guard lock(linkerMutex);
+        if (linkerCanRunAgain)
+        {
+            result = lld::lldMain(args, llvm::outs(), llvm::errs(), {{lld::Gnu, &lld::elf::link}});
+            linkerCanRunAgain = result->canRunAgain;
+        }
+    }
+
+    for (int fd : objectFDs)
+        close(fd);
+
+    if (!result)
+        Error({}, "Can't link {}, the linker can't run again in this process after an earlier link failed", outputFilename);
+
+    // NOTE: LLD already printed what went wrong
+    if (result->retCode != 0)
+        Error({}, "Linking {} failed", outputFilename);
+}
+
+int Context::CreateObjectFile() const
+{
+    auto directory = std::filesystem::temp_directory_path().string();
+    int fd = open(directory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+
+    // Not every filesystem supports unnamed files
+    if (fd < 0 && errno == EOPNOTSUPP)
+        fd = memfd_create("neon-object", MFD_CLOEXEC);
+
+    if (fd < 0)
+        Error({}, "Can't create a file for an object in {}: {}", directory, strerror(errno));
+
+    return fd;
+}
+
+std::string Context::OutputFilename(OutputFileType fileType, std::optional<std::string> outputLocation) const
+{
+    return OutputFilename(files.at(rootFileID).filename, fileType, outputLocation);
+}
+
+std::string Context::OutputFilename(const std::string& rootFilename, OutputFileType fileType, std::optional<std::string> outputLocation)
+{
+    if (outputLocation.has_value())
+        return outputLocation.value();
+
+    auto baseFilename = rootFilename.substr(rootFilename.find_last_of("/\\") + 1);
+    auto fileWithoutExtension = baseFilename.substr(0, baseFilename.find_last_of('.'));
+
+    switch (fileType)
+    {
+        case OutputFileType::Assembly:   return fileWithoutExtension + ".asm";
+        case OutputFileType::Object:     return fileWithoutExtension + ".o";
+        case OutputFileType::Bitcode:    return fileWithoutExtension + ".bc";
+        case OutputFileType::Executable: return fileWithoutExtension;
+    }
+
+    std::unreachable();
+}
+
+void Context::Emit(llvm::raw_pwrite_stream& stream, llvm::CodeGenFileType fileType) const
+{
+    llvm::legacy::PassManager pass;
+
+    if (targetMachine->addPassesToEmitFile(pass, stream, nullptr, fileType))
+        Error({}, "This machine can't emit this file type");
+
+    CodegenTimer timer;
+    pass.run(*module);
+}
+
+std::string Context::Write(
+    OutputFileType fileType, std::optional<std::string> outputLocation, const std::vector<std::string>& linkInputs, uint32_t jobs) const
+{
     bool foundMain = false;
     for (auto& function : module->functions())
     {
@@ -219,63 +801,115 @@ void Context::Write(OutputFileType fileType, std::optional<std::string> outputLo
         }
     }
 
-    if (!foundMain)
+    if (!foundMain && !compilingModule)
     {
         Error({}, "No main function found");
     }
 
-    auto mainFile = files.at(rootFileID).filename;
+    // With ThinLTO, objects are bitcode with a summary and the linker generates the code
+    bool writesBitcode = fileType == OutputFileType::Bitcode || (thinLTO && fileType != OutputFileType::Assembly);
 
-    auto baseFilename = mainFile.substr(mainFile.find_last_of("/\\") + 1);
-    auto fileWithoutExtension = baseFilename.substr(0, baseFilename.find_last_of('.'));
+    // Objects for executables never touch the disk, they are handed to the linker from memory
+    std::vector<llvm::SmallVector<char, 0>> objects(fileType == OutputFileType::Executable ? (writesBitcode ? 1 : jobs) : 0);
+    std::vector<Own<llvm::raw_pwrite_stream>> outputStreams;
+    for (auto& object : objects)
+        outputStreams.push_back(MakeOwn<llvm::raw_svector_ostream>(object));
 
-    std::string objectFilename;
-    if (fileType == OutputFileType::Executable)
+    auto outputFilename = OutputFilename(fileType, outputLocation);
+    if (fileType != OutputFileType::Executable)
+    {
+        std::error_code errorCode;
+        outputStreams.push_back(MakeOwn<llvm::raw_fd_ostream>(outputFilename, errorCode, llvm::sys::fs::OF_None));
+
+        if (errorCode)
+            Error({}, "Error writing output: {}", errorCode.message());
+    }
+
+    if (writesBitcode)
     {
-        objectFilename = std::filesystem::temp_directory_path() / ("tempobject" + baseFilename + ".o");
+        if (thinLTO)
+        {
+            llvm::ProfileSummaryInfo profileSummary(*module);
+            auto summary = llvm::buildModuleSummaryIndex(*module, nullptr, &profileSummary);
+            llvm::WriteBitcodeToFile(*module, *outputStreams[0], false, &summary);
+        }
+        else
+        {
+            llvm::WriteBitcodeToFile(*module, *outputStreams[0]);
+        }
     }
-    else if (outputLocation.has_value())
+    else if (outputStreams.size() > 1)
     {
-        objectFilename = outputLocation.value();
+        // Every partition gets its own LLVM context and target machine, and is emitted on its own thread
+        std::vector<llvm::raw_pwrite_stream*> partitionStreams;
+        for (const auto& outputStream : outputStreams)
+            partitionStreams.push_back(outputStream.get());
+
+        CodegenTimer timer;
+        llvm::splitCodeGen(*module, partitionStreams, {}, [this] { return CreateTargetMachine(); }, llvm::CodeGenFileType::ObjectFile);
     }
     else
     {
-        objectFilename = fileType == OutputFileType::Assembly ? fileWithoutExtension + ".asm" : fileWithoutExtension + ".o";
+        Emit(*outputStreams[0],
+             fileType == OutputFileType::Assembly ? llvm::CodeGenFileType::AssemblyFile : llvm::CodeGenFileType::ObjectFile);
     }
 
-    std::error_code errorCode;
-    llvm::raw_fd_ostream outputStream(objectFilename, errorCode, llvm::sys::fs::OF_None);
+    outputStreams.clear();
 
-    if (errorCode)
-    {
-        std::println(std::cerr, "Error writing output: {}", errorCode.message());
-        exit(1);
-    }
+    if (fileType == OutputFileType::Executable)
+        Link(objects, linkInputs, outputFilename, jobs);
 
-    llvm::legacy::PassManager pass;
+    return outputFilename;
+}
 
-    if (targetMachine->addPassesToEmitFile(
-            pass,
-            outputStream,
-            nullptr,
-            fileType == OutputFileType::Assembly ? llvm::CodeGenFileType::AssemblyFile : llvm::CodeGenFileType::ObjectFile))
-    {
-        std::println(std::cerr, "This machine can't emit this file type");
-        exit(1);
-    }
+struct SymbolInfo
+{
+    std::string name;
+    bool isFunction;
+    uint64_t size;
+};
 
-    pass.run(*module);
-    outputStream.flush();
+// Functions and globals with a known size
+static std::vector<SymbolInfo> ReadSymbols(const std::string& filename)
+{
+    auto binary = llvm::object::ObjectFile::createObjectFile(filename);
+    if (!binary)
+        g_context->Error({}, "Can't read symbols from {}: {}", filename, llvm::toString(binary.takeError()));
 
-    if (fileType == OutputFileType::Executable)
+    auto elf = llvm::dyn_cast<llvm::object::ELFObjectFileBase>(binary->getBinary());
+    if (!elf)
+        g_context->Error({}, "Reading symbols is only supported for ELF files");
+
+    std::vector<SymbolInfo> symbols;
+    for (const auto& symbol : elf->symbols())
     {
-        std::string binaryFilename = outputLocation.has_value() ? outputLocation.value() : fileWithoutExtension;
+        auto name = symbol.getName();
+        auto type = symbol.getType();
+        if (!name || !type || symbol.getSize() == 0)
+        {
+            llvm::consumeError(name.takeError());
+            llvm::consumeError(type.takeError());
+            continue;
+        }
+
+        if (*type == llvm::object::SymbolRef::ST_Function || *type == llvm::object::SymbolRef::ST_Data)
+            symbols.push_back({name->str(), *type == llvm::object::SymbolRef::ST_Function, symbol.getSize()});
+    }
 
-        system((std::string("gcc ") + objectFilename + " -o " + binaryFilename + " -no-pie").c_str());
+    return symbols;
+}
 
-        std::filesystem::remove(objectFilename);
+void Context::PrintSizeReport(const std::string& filename) const
+{
+    auto symbols = ReadSymbols(filename);
+    std::stable_sort(symbols.begin(), symbols.end(), [](const auto& a, const auto& b) { return a.size > b.size; });
 
-        if (run)
-            execl(binaryFilename.c_str(), binaryFilename.c_str(), nullptr);
+    uint64_t total = 0;
+    std::println("{:>10}  {:<8}  {}", "Size", "Kind", "Name");
+    for (const auto& symbol : symbols)
+    {
+        std::println("{:>10}  {:<8}  {}", symbol.size, symbol.isFunction ? "function" : "global", symbol.name);
+        total += symbol.size;
     }
+    std::println("{:>10}  {:<8}", total, "total");
 }
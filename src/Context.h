@@ -16,10 +16,54 @@
 #include <map>
 #include <optional>
 #include <print>
+#include <stdexcept>
+
+// Thrown for errors in the compiled program, so they don't end the process that compiles it
+struct CompileError : public std::runtime_error
+{
+    std::string filename; // Empty for errors that aren't about a place in the source
+    uint32_t line;
+    uint32_t column;
+    std::string message;
+
+    inline CompileError(std::string filename, uint32_t line, uint32_t column, std::string message)
+        : std::runtime_error(filename.empty() ? message : std::format("{}:{}:{} {}", filename, line, column, message))
+        , filename(std::move(filename))
+        , line(line)
+        , column(column)
+        , message(std::move(message))
+    {
+    }
+};
+
+// How to compile a program, the defaults are an unoptimized build for the host
+struct ContextOptions
+{
+    std::optional<std::string> target;   // Target triple, the host's when missing
+    std::optional<std::string> cpu;      // Target CPU, or native for the host CPU
+    std::optional<std::string> features; // Target features, e.g. +avx2,+bmi2
+    llvm::TargetOptions targetOptions;
+    llvm::OptimizationLevel optimizationLevel = llvm::OptimizationLevel::O0;
+    std::optional<llvm::PGOOptions> pgoOptions;
+    bool thinLTO = false;
+    bool debug = false;
+    bool debugLineTablesOnly = false;
+    bool freestanding = false;
+    bool framePointers = false;
+    bool unwindTables = false;
+    bool discardValueNames = true; // Names only make the IR readable, so they are only kept for dumping it
+};
 
 struct Context
 {
-    Context(const std::string& baseFile, std::optional<std::string> target, bool optimize, bool debug);
+    Context(const std::string& baseFile, const ContextOptions& options, std::map<std::string, std::string> sources = {});
+
+    // Creates a context for parsing or generating a part of the program on another thread, it shares the
+    // target and the loaded files with the parent, but has its own LLVM context and module
+    Context(const Context& parent, const std::string& moduleName);
+
+    // Registers every target LLVM was built with, only the first call does anything
+    static void InitializeTargets();
 
     Own<llvm::LLVMContext> llvmContext;
     Own<llvm::Module> module;
@@ -29,15 +73,7 @@ struct Context
     Own<llvm::DIBuilder> debugBuilder;
     llvm::DICompileUnit* debugCompileUnit;
 
-    Own<llvm::FunctionPassManager> functionPassManager;
-    Own<llvm::LoopAnalysisManager> loopAnalysisManager;
-    Own<llvm::FunctionAnalysisManager> functionAnalysisManager;
-    Own<llvm::CGSCCAnalysisManager> cgsccAnalysisManager;
-    Own<llvm::ModuleAnalysisManager> moduleAnalysisManager;
-    Own<llvm::PassInstrumentationCallbacks> passInstrumentationCallbacks;
-    Own<llvm::StandardInstrumentations> standardInstrumentations;
-
-    llvm::TargetMachine* targetMachine;
+    Own<llvm::TargetMachine> targetMachine;
 
     struct StructInfo
     {
@@ -45,45 +81,111 @@ struct Context
         std::map<std::string, Ref<Type>> members;
         llvm::StructType* llvmType;
         llvm::DIType* debugType;
+        Location location;
     };
 
     std::map<std::string, StructInfo> structs;
+    std::vector<std::string> structOrder; // In order of definition, so members always refer to earlier structs
 
-    bool optimize;
+    // Interned string literals, the character data and the `string` structs pointing to it
+    std::map<std::string, llvm::GlobalVariable*> stringLiteralData;
+    std::map<std::string, llvm::GlobalVariable*> stringLiterals;
+
+    llvm::OptimizationLevel optimizationLevel;
+    std::optional<llvm::PGOOptions> pgoOptions; // Instrumenting for or using a profile
+    bool thinLTO;                               // Objects are bitcode with a summary, code is generated when linking
     bool debug;
+    bool debugLineTablesOnly; // Only enough debug info to map addresses to functions and lines, no variables or types
+    bool freestanding;  // No libc, we provide _start and the standard library implements everything on top of syscalls
+    bool framePointers; // Keep frame pointers in every function, so profilers can walk the stack without DWARF
+    bool unwindTables;  // Emit unwind tables even though nothing in Neon unwinds
+    bool compilingModule = false; // Compiling a module for `import`, it exports its functions instead of having main
 
     uint32_t rootFileID;
+    uint32_t nextFileID = 0;
+    uint32_t fileIDStride = 1; // Threads parsing separate sources give out interleaved IDs, so their files can be merged
     std::map<uint32_t, FileInfo> files;
+    std::map<std::string, std::string> sources; // Files compiled from memory instead of from the disk, by filename
+    std::vector<std::string> importPaths;       // Directories `import` also looks in, after the working directory
 
     std::vector<std::string> defines;
 
-    void CreateSyscall(uint32_t number, std::string mnemonic, std::string returnRegister, std::string registers);
+    void CreateSyscall(uint32_t number, std::string mnemonic, std::string returnRegister, std::string registers, std::string clobbers);
+    std::optional<llvm::MemoryEffects> GetSyscallMemoryEffects(const std::string& name) const;
+
+    void CreateDebugCompileUnit();
+
+    // Target machines cache subtargets internally, so every thread that generates code needs its own
+    Own<llvm::TargetMachine> CreateTargetMachine() const;
+
+    void AddStruct(const std::string& name, const std::map<std::string, Ref<Type>>& members, Location location);
+    void CopyStructsFrom(const Context& other);
 
     uint32_t LoadFile(const std::string& filename);
 
+    // Every file that was loaded, once each (sources parsed on separate threads can load the same include)
+    std::vector<std::string> LoadedFilenames() const;
+
     std::pair<uint32_t, uint32_t> LineColumnFromLocation(uint32_t fileID, size_t index) const;
 
     template <class... Args>
     [[noreturn]] void Error(Location location, std::string_view msg, Args&&... args) const
     {
+        auto message = std::vformat(msg, std::make_format_args(args...));
         if (location.fileID.has_value())
-            std::print(std::cerr, "{}:{}:{} ", location.GetFile().filename, location.line, location.column);
+            throw CompileError(files.at(location.fileID.value()).filename, location.line, location.column, message);
 
-        std::println(std::cerr, "{}", std::vformat(msg, std::make_format_args(args...)));
-
-        exit(1);
+        throw CompileError("", 0, 0, message);
     }
 
     void Finalize();
+    void Verify() const;
+
+    enum class OptimizationPhase
+    {
+        Full,
+        PreLink,
+        PostLink
+    };
+
+    void Optimize(OptimizationPhase phase = OptimizationPhase::Full);
 
     enum class OutputFileType
     {
         Assembly,
         Object,
+        Bitcode,
         Executable
     };
 
-    void Write(OutputFileType fileType, std::optional<std::string> outputLocation, bool run = false) const;
+    // Link inputs are extra objects, archives or bitcode, like C code compiled by clang
+    void Link(
+        const std::vector<llvm::SmallVector<char, 0>>& objects,
+        const std::vector<std::string>& linkInputs,
+        const std::string& outputFilename,
+        uint32_t jobs) const;
+
+    // An unnamed file in the temporary directory to emit an object into, it's removed when the descriptor is closed
+    // NOTE: LLD only takes paths, it reads the file from /proc/self/fd/<descriptor>
+    int CreateObjectFile() const;
+
+    std::string OutputFilename(OutputFileType fileType, std::optional<std::string> outputLocation) const;
+    static std::string OutputFilename(const std::string& rootFilename, OutputFileType fileType, std::optional<std::string> outputLocation);
+
+    // Generates machine code for the module with the legacy pass manager, the new one can't do that yet
+    void Emit(llvm::raw_pwrite_stream& stream, llvm::CodeGenFileType fileType) const;
+
+    // With more than one job, executables are split into that many objects which are emitted in parallel
+    // Returns the name of the written file
+    std::string Write(
+        OutputFileType fileType,
+        std::optional<std::string> outputLocation,
+        const std::vector<std::string>& linkInputs = {},
+        uint32_t jobs = 1) const;
+
+    // Lists the functions and globals in an object or executable by their size
+    void PrintSizeReport(const std::string& filename) const;
 };
 
-extern Ref<Context> g_context;
+// NOTE: Every code generation thread has its own context
+extern thread_local Ref<Context> g_context;
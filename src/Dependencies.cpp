@@ -0,0 +1,111 @@
+#include <Context.h>
+#include <Dependencies.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/SHA256.h>
+
+// Make splits prerequisites on spaces and expands variables, so those have to be escaped
+[[nodiscard]] static std::string EscapeForMake(const std::string& filename)
+{
+    std::string escaped;
+    for (char c : filename)
+    {
+        if (c == ' ' || c == '#')
+            escaped.push_back('\\');
+        else if (c == '$')
+            escaped.push_back('$');
+
+        escaped.push_back(c);
+    }
+
+    return escaped;
+}
+
+void WriteDepfile(const std::string& filename, const std::vector<std::string>& targets, const std::vector<std::string>& inputs)
+{
+    std::ofstream depfile(filename);
+    for (size_t i = 0; i < targets.size(); i++)
+        depfile << (i == 0 ? "" : " ") << EscapeForMake(targets[i]);
+    depfile << ":";
+    for (const auto& input : inputs)
+        depfile << " \\\n  " << EscapeForMake(input);
+    depfile << "\n";
+
+    if (!depfile)
+        g_context->Error({}, "Can't write dependency file {}", filename);
+}
+
+[[nodiscard]] static std::string StampFilename(const std::string& outputFilename)
+{
+    return outputFilename + ".stamp";
+}
+
+// NOTE: A rebuilt compiler can generate different code from the same arguments
+[[nodiscard]] static std::string HashArguments(const std::vector<std::string>& arguments)
+{
+    llvm::SHA256 hasher;
+    hasher.update(CompilerIdentity());
+
+    // Relative paths in the arguments mean other files in another directory
+    std::error_code errorCode;
+    hasher.update(std::filesystem::current_path(errorCode).string());
+    for (const auto& argument : arguments)
+    {
+        hasher.update(argument);
+        hasher.update(llvm::ArrayRef<uint8_t>{0});
+    }
+
+    return llvm::toHex(hasher.final(), true);
+}
+
+[[nodiscard]] static std::optional<std::string> HashFile(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+        return {};
+
+    std::string content{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    return llvm::toHex(llvm::SHA256::hash(llvm::arrayRefFromStringRef(content)), true);
+}
+
+bool IsUpToDate(const std::vector<std::string>& outputFilenames, const std::vector<std::string>& arguments)
+{
+    if (!std::ranges::all_of(outputFilenames, [](const auto& filename) { return std::filesystem::exists(filename); }))
+        return false;
+
+    std::ifstream stamp(StampFilename(outputFilenames.front()));
+    std::string line;
+    if (!std::getline(stamp, line) || line != HashArguments(arguments))
+        return false;
+
+    // Every other line is the hash of an input followed by its name
+    while (std::getline(stamp, line))
+    {
+        auto separator = line.find(' ');
+        if (separator == std::string::npos || HashFile(line.substr(separator + 1)) != line.substr(0, separator))
+            return false;
+    }
+
+    return true;
+}
+
+void WriteStamp(const std::string& outputFilename, const std::vector<std::string>& arguments, const std::vector<std::string>& inputs)
+{
+    std::ofstream stamp(StampFilename(outputFilename));
+    stamp << HashArguments(arguments) << "\n";
+    for (const auto& input : inputs)
+    {
+        auto hash = HashFile(input);
+        if (!hash)
+            g_context->Error({}, "Can't read {}", input);
+
+        stamp << *hash << " " << input << "\n";
+    }
+
+    if (!stamp)
+        g_context->Error({}, "Can't write {}", StampFilename(outputFilename));
+}
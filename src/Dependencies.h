@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Writes a Makefile rule saying that every one of `targets` depends on every one of `inputs`, for build systems to include
+void WriteDepfile(const std::string& filename, const std::vector<std::string>& targets, const std::vector<std::string>& inputs);
+
+// A stamp next to the first output records a hash of the compiler and the arguments, and a hash of every input of the build
+// The outputs are up to date when all of them exist and none of those changed, which is checked without initializing LLVM
+bool IsUpToDate(const std::vector<std::string>& outputFilenames, const std::vector<std::string>& arguments);
+void WriteStamp(const std::string& outputFilename, const std::vector<std::string>& arguments, const std::vector<std::string>& inputs);
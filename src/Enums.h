@@ -57,3 +57,34 @@ struct std::formatter<BinaryOperation>
         return std::format_to(ctx.out(), "{}", str);
     }
 };
+
+enum class FunctionPurity
+{
+    Pure,
+    ReadOnly,
+    WritesArgsOnly,
+    SideEffecting,
+};
+
+template <>
+struct std::formatter<FunctionPurity>
+{
+    constexpr auto parse(std::format_parse_context& ctx) { return std::cbegin(ctx); }
+
+    auto format(const FunctionPurity& obj, std::format_context& ctx) const
+    {
+        std::string str = "???";
+
+        switch (obj)
+        {
+            using enum FunctionPurity;
+            case Pure:           str = "Pure"; break;
+            case ReadOnly:       str = "ReadOnly"; break;
+            case WritesArgsOnly: str = "WritesArgsOnly"; break;
+            case SideEffecting:  str = "SideEffecting"; break;
+            default:             str = "???"; break;
+        }
+
+        return std::format_to(ctx.out(), "{}", str);
+    }
+};
@@ -0,0 +1,361 @@
+#include <Interface.h>
+#include <TypeCasts.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <llvm/Analysis/ConstantFolding.h>
+#include <llvm/Support/LEB128.h>
+
+// Interfaces written by another version of the layout are rejected instead of misread
+static constexpr std::string_view interfaceMagic = "NEONI";
+static constexpr uint64_t interfaceVersion = 1;
+
+enum class InterfaceTypeKind : uint8_t
+{
+    Integer,
+    Array,
+    Pointer,
+    Struct,
+    Void
+};
+
+// Integers are LEB128, strings are their size followed by the characters
+class InterfaceWriter
+{
+public:
+    void WriteMagic()
+    {
+        m_stream << interfaceMagic;
+        WriteInteger(interfaceVersion);
+    }
+
+    void WriteInteger(uint64_t value) { llvm::encodeULEB128(value, m_stream); }
+
+    void WriteString(std::string_view value)
+    {
+        WriteInteger(value.size());
+        m_stream << value;
+    }
+
+    void WriteType(const Ref<Type>& type)
+    {
+        if (auto* integerType = as_if<IntegerType>(type))
+        {
+            WriteInteger(static_cast<uint64_t>(InterfaceTypeKind::Integer));
+            WriteInteger(integerType->bits);
+            WriteInteger(integerType->isSigned);
+        }
+        else if (auto* arrayType = as_if<ArrayType>(type))
+        {
+            WriteInteger(static_cast<uint64_t>(InterfaceTypeKind::Array));
+            WriteType(arrayType->arrayType);
+            WriteInteger(arrayType->size);
+        }
+        else if (auto* pointerType = as_if<PointerType>(type))
+        {
+            WriteInteger(static_cast<uint64_t>(InterfaceTypeKind::Pointer));
+            WriteType(pointerType->underlayingType);
+        }
+        else if (auto* structType = as_if<StructType>(type))
+        {
+            WriteInteger(static_cast<uint64_t>(InterfaceTypeKind::Struct));
+            WriteString(structType->name);
+        }
+        else
+        {
+            assert(is<VoidType>(type));
+            WriteInteger(static_cast<uint64_t>(InterfaceTypeKind::Void));
+        }
+
+        WriteInteger(type->isRef);
+    }
+
+    const std::string& Data() { return m_stream.str(); }
+
+private:
+    std::string m_data;
+    llvm::raw_string_ostream m_stream{m_data};
+};
+
+class InterfaceReader
+{
+public:
+    inline InterfaceReader(const FileInfo& file, Location location)
+        : m_file(file)
+        , m_location(location)
+    {
+    }
+
+    [[nodiscard]] bool ReadMagic()
+    {
+        if (!std::string_view(m_file.content.data(), m_file.content.size()).starts_with(interfaceMagic))
+            return false;
+
+        m_offset = interfaceMagic.size();
+        return ReadInteger() == interfaceVersion;
+    }
+
+    uint64_t ReadInteger()
+    {
+        auto* begin = reinterpret_cast<const uint8_t*>(m_file.content.data());
+        unsigned length = 0;
+        const char* error = nullptr;
+        auto value = llvm::decodeULEB128(begin + m_offset, &length, begin + m_file.content.size(), &error);
+        if (error)
+            Corrupt();
+
+        m_offset += length;
+        return value;
+    }
+
+    // Every element takes at least a byte, so a corrupt count can't make us allocate more than the file's size
+    uint64_t ReadCount()
+    {
+        auto count = ReadInteger();
+        if (count > m_file.content.size() - m_offset)
+            Corrupt();
+
+        return count;
+    }
+
+    std::string ReadString()
+    {
+        auto size = ReadCount();
+
+        std::string value(m_file.content.data() + m_offset, size);
+        m_offset += size;
+        return value;
+    }
+
+    // Only types the parser could have made are accepted, anything else would crash the compiler later
+    // NOTE: Structs have to be known already, the interface lists them before anything that uses them
+    //       The members of a struct can also point to the struct itself, which is `structBeingRead`
+    Ref<Type> ReadType(bool allowVoid = false, std::string_view structBeingRead = {}, bool insidePointer = false)
+    {
+        Ref<Type> type;
+        switch (static_cast<InterfaceTypeKind>(ReadInteger()))
+        {
+            case InterfaceTypeKind::Integer:
+            {
+                auto bits = ReadInteger();
+                if (bits != 8 && bits != 16 && bits != 32 && bits != 64)
+                    Corrupt();
+
+                type = MakeRef<IntegerType>(static_cast<uint16_t>(bits), ReadInteger() != 0);
+                break;
+            }
+            case InterfaceTypeKind::Array:
+            {
+                auto arrayType = ReadType(false, structBeingRead, insidePointer);
+                type = MakeRef<ArrayType>(arrayType, ReadInteger());
+                break;
+            }
+            case InterfaceTypeKind::Pointer: type = MakeRef<PointerType>(ReadType(true, structBeingRead, true)); break;
+            case InterfaceTypeKind::Struct:
+            {
+                auto name = ReadString();
+                if (!g_context->structs.contains(name) && !(insidePointer && name == structBeingRead))
+                    Corrupt();
+
+                type = MakeRef<StructType>(name);
+                break;
+            }
+            case InterfaceTypeKind::Void:
+            {
+                if (!allowVoid)
+                    Corrupt();
+
+                type = MakeRef<VoidType>();
+                break;
+            }
+            default: Corrupt();
+        }
+
+        type->isRef = ReadInteger() != 0;
+        return type;
+    }
+
+    bool AtEnd() const { return m_offset == m_file.content.size(); }
+
+    [[noreturn]] void Corrupt() const { g_context->Error(m_location, "Corrupt interface file: {}", m_file.filename); }
+
+private:
+    const FileInfo& m_file;
+    Location m_location;
+    size_t m_offset = 0;
+};
+
+void WriteInterface(const std::string& filename)
+{
+    InterfaceWriter writer;
+    writer.WriteMagic();
+
+    // Every struct, even the ones from includes, importers check that theirs have the same layout
+    writer.WriteInteger(g_context->structOrder.size());
+    for (const auto& name : g_context->structOrder)
+    {
+        const auto& members = g_context->structs.at(name).members;
+        writer.WriteString(name);
+        writer.WriteInteger(members.size());
+        for (const auto& [memberName, memberType] : members)
+        {
+            writer.WriteString(memberName);
+            writer.WriteType(memberType);
+        }
+    }
+
+    // NOTE: Consts are folded into the code that uses them, so importers get their values instead of a symbol
+    std::vector<std::pair<Ref<VariableDefinitionAST>, llvm::ConstantInt*>> consts;
+    for (const auto& variable : g_parsedFile->globalVariables)
+    {
+        if (!variable->exported)
+            continue;
+
+        auto constant = variable->initialValue->TryEvaluateAsConstant();
+        if (!constant)
+            continue;
+
+        constant = llvm::ConstantFoldIntegerCast(
+            constant,
+            variable->type->GetType(),
+            as<IntegerType>(variable->initialValue->GetType())->isSigned,
+            g_context->module->getDataLayout());
+        if (auto* value = llvm::dyn_cast_or_null<llvm::ConstantInt>(constant))
+            consts.emplace_back(variable, value);
+    }
+
+    writer.WriteInteger(consts.size());
+    for (const auto& [variable, value] : consts)
+    {
+        writer.WriteString(variable->name);
+        writer.WriteType(variable->type);
+        writer.WriteInteger(as<IntegerType>(variable->type)->isSigned ? value->getSExtValue() : value->getZExtValue());
+    }
+
+    std::vector<Ref<FunctionAST>> functions;
+    std::ranges::copy_if(g_parsedFile->functions, std::back_inserter(functions), [](const auto& function) { return function->exported; });
+
+    writer.WriteInteger(functions.size());
+    for (const auto& function : functions)
+    {
+        writer.WriteString(function->name);
+        writer.WriteType(function->returnType);
+        writer.WriteInteger(function->params.size());
+        for (const auto& param : function->params)
+        {
+            writer.WriteString(param.name);
+            writer.WriteType(param.type);
+            writer.WriteInteger(param.isWritten);
+        }
+
+        writer.WriteInteger(function->memoryEffects.toIntValue());
+        writer.WriteInteger(function->willReturn);
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    file << writer.Data();
+    if (!file)
+        g_context->Error({}, "Can't write interface {}", filename);
+}
+
+[[nodiscard]] static bool SameMembers(const std::map<std::string, Ref<Type>>& members, const std::map<std::string, Ref<Type>>& other)
+{
+    return std::ranges::equal(
+        members, other, [](const auto& member, const auto& otherMember)
+        { return member.first == otherMember.first && *member.second == *otherMember.second; });
+}
+
+// The working directory comes first, then every --import-path in order
+[[nodiscard]] static std::string InterfaceFilename(const std::string& name)
+{
+    auto filename = name + ".nei";
+    if (g_context->sources.contains(filename) || std::filesystem::is_regular_file(filename))
+        return filename;
+
+    for (const auto& directory : g_context->importPaths)
+    {
+        auto candidate = (std::filesystem::path(directory) / filename).string();
+        if (std::filesystem::is_regular_file(candidate))
+            return candidate;
+    }
+
+    // NOTE: Loading a missing file reports it
+    return filename;
+}
+
+void ImportInterface(
+    const std::string& name,
+    Location location,
+    std::vector<Ref<FunctionAST>>& functions,
+    std::vector<Ref<VariableDefinitionAST>>& globalVariables)
+{
+    auto fileID = g_context->LoadFile(InterfaceFilename(name));
+    const auto& file = g_context->files.at(fileID);
+
+    InterfaceReader reader(file, location);
+    if (!reader.ReadMagic())
+        g_context->Error(location, "{} is not an interface file, or it was written by another version of the compiler", file.filename);
+
+    // Everything declared by the interface is reported at its start
+    Location declaredLocation(fileID, 0);
+
+    auto structCount = reader.ReadCount();
+    for (uint64_t i = 0; i < structCount; i++)
+    {
+        auto structName = reader.ReadString();
+        std::map<std::string, Ref<Type>> members;
+        auto memberCount = reader.ReadCount();
+        for (uint64_t j = 0; j < memberCount; j++)
+        {
+            auto memberName = reader.ReadString();
+            members[memberName] = reader.ReadType(false, structName);
+        }
+
+        if (auto existing = g_context->structs.find(structName); existing != g_context->structs.end())
+        {
+            if (!SameMembers(members, existing->second.members))
+                g_context->Error(location, "Struct {} in {} doesn't match the one defined here", structName, file.filename);
+
+            continue;
+        }
+
+        g_context->AddStruct(structName, members, declaredLocation);
+    }
+
+    auto constCount = reader.ReadCount();
+    for (uint64_t i = 0; i < constCount; i++)
+    {
+        auto constName = reader.ReadString();
+        auto type = reader.ReadType();
+        if (!is<IntegerType>(type))
+            reader.Corrupt();
+
+        auto value = MakeRef<NumberExpressionAST>(declaredLocation, reader.ReadInteger(), StaticRefCast<IntegerType>(type));
+        globalVariables.push_back(MakeRef<VariableDefinitionAST>(declaredLocation, constName, type, true, value));
+    }
+
+    auto functionCount = reader.ReadCount();
+    for (uint64_t i = 0; i < functionCount; i++)
+    {
+        auto functionName = reader.ReadString();
+        auto returnType = reader.ReadType(true);
+
+        std::vector<FunctionAST::Param> params(reader.ReadCount());
+        for (auto& param : params)
+        {
+            param.name = reader.ReadString();
+            param.type = reader.ReadType();
+            param.isWritten = reader.ReadInteger() != 0;
+        }
+
+        auto function = MakeRef<FunctionAST>(declaredLocation, functionName, params, returnType, nullptr);
+        function->imported = true;
+        function->memoryEffects = llvm::MemoryEffects::createFromIntValue(reader.ReadInteger());
+        function->willReturn = reader.ReadInteger() != 0;
+        functions.push_back(function);
+    }
+
+    if (!reader.AtEnd())
+        reader.Corrupt();
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <AST.h>
+
+// A module's interface (a .nei file) is everything its importers need to call into it: the signatures and effects of
+// the functions it exports, the values of its integer consts and the layouts of the structs they can use
+// Importers never see the module's source, so changing a body only rebuilds the module itself
+
+// Writes the interface of the module being compiled, from the functions and consts marked as exported
+void WriteInterface(const std::string& filename);
+
+// Declares the contents of `<name>.nei` in the file being parsed, `location` is the import
+void ImportInterface(
+    const std::string& name,
+    Location location,
+    std::vector<Ref<FunctionAST>>& functions,
+    std::vector<Ref<VariableDefinitionAST>>& globalVariables);
@@ -3,7 +3,7 @@
 
 TokenStream CreateTokenStream(uint32_t fileID)
 {
-    static_assert(static_cast<uint32_t>(TokenType::_TokenTypeCount) == 39, "Not all tokens are handled in Lexer::NextToken()");
+    static_assert(static_cast<uint32_t>(TokenType::_TokenTypeCount) == 40, "Not all tokens are handled in Lexer::NextToken()");
 
     std::vector<Token> tokens;
     size_t index = 0;
@@ -204,6 +204,8 @@ TokenStream CreateTokenStream(uint32_t fileID)
                         tokens.push_back({.type = TokenType::While, .location = {fileID, trueBeginIndex}});
                     else if (value == "include")
                         tokens.push_back({.type = TokenType::Include, .location = {fileID, trueBeginIndex}});
+                    else if (value == "import")
+                        tokens.push_back({.type = TokenType::Import, .location = {fileID, trueBeginIndex}});
                     else if (value == "struct")
                         tokens.push_back({.type = TokenType::Struct, .location = {fileID, trueBeginIndex}});
                     else if (value == "var")
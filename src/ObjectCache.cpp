@@ -0,0 +1,278 @@
+#include <ObjectCache.h>
+#include <Timing.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
+#include <thread>
+#include <unistd.h>
+
+[[nodiscard]] static std::string ToHex(const std::array<uint8_t, 32>& hash)
+{
+    return llvm::toHex(hash, true);
+}
+
+ObjectCache::ObjectCache(const std::filesystem::path& directory, uint64_t maxSize)
+    : directory(directory)
+    , maxSize(maxSize)
+{
+    std::error_code errorCode;
+    std::filesystem::create_directories(directory, errorCode);
+    if (errorCode)
+        g_context->Error({}, "Can't create cache directory {}: {}", directory.string(), errorCode.message());
+
+    StableHasher hasher;
+
+    // NOTE: We can't tell what changed in a rebuilt compiler, so any change to it starts a new cache
+    hasher.add(llvm::StringRef(LLVM_VERSION_STRING));
+    hasher.add(CompilerIdentity());
+
+    const auto& targetMachine = *g_context->targetMachine;
+    hasher.add(targetMachine.getTargetTriple().str());
+    hasher.add(targetMachine.getTargetCPU());
+    hasher.add(targetMachine.getTargetFeatureString());
+    hasher.add(targetMachine.Options.FunctionSections);
+    hasher.add(targetMachine.Options.DataSections);
+
+    hasher.add(g_context->optimizationLevel.getSpeedupLevel());
+    hasher.add(g_context->optimizationLevel.getSizeLevel());
+    hasher.add(g_context->debug);
+    hasher.add(g_context->debugLineTablesOnly);
+    hasher.add(g_context->freestanding);
+    hasher.add(g_context->framePointers);
+    hasher.add(g_context->unwindTables);
+
+    hasher.add(g_context->pgoOptions.has_value());
+    if (g_context->pgoOptions.has_value())
+    {
+        hasher.add(static_cast<uint32_t>(g_context->pgoOptions->Action));
+        if (g_context->pgoOptions->Action == llvm::PGOOptions::IRUse)
+        {
+            auto profile = ReadFile(g_context->pgoOptions->ProfileFile);
+            hasher.add(llvm::StringRef(profile.data(), profile.size()));
+        }
+    }
+
+    for (const auto& name : g_context->structOrder)
+    {
+        hasher.add(name);
+        for (const auto& [memberName, memberType] : g_context->structs.at(name).members)
+        {
+            hasher.add(memberName);
+            hasher.add(memberType->Dump());
+            hasher.add(memberType->isRef);
+        }
+    }
+
+    // Constant globals are folded into the functions that use them
+    for (const auto& variable : g_parsedFile->globalVariables)
+        variable->Hash(hasher);
+
+    buildHash = ToHex(hasher.final());
+}
+
+// Callees are declared in every object, and calls to pure functions can even be evaluated at compile time
+static void HashCallees(StableHasher& hasher, const FunctionAST& function, std::set<std::string>& visited)
+{
+    for (const auto& calleeName : function.callees)
+    {
+        if (!visited.insert(calleeName).second)
+            continue;
+
+        auto callee = g_parsedFile->FindFunction(calleeName);
+        if (callee->GetPurity() == FunctionPurity::Pure)
+        {
+            callee->Hash(hasher);
+            HashCallees(hasher, *callee, visited);
+        }
+        else
+        {
+            callee->HashSignature(hasher);
+        }
+    }
+}
+
+std::string ObjectCache::Key(bool definesGlobals, const std::vector<Ref<FunctionAST>>& functions) const
+{
+    StableHasher hasher;
+    hasher.add(buildHash);
+    hasher.add(definesGlobals);
+
+    std::set<std::string> visited;
+    for (const auto& function : functions)
+    {
+        function->Hash(hasher);
+        HashCallees(hasher, *function, visited);
+    }
+
+    return ToHex(hasher.final());
+}
+
+std::optional<llvm::SmallVector<char, 0>> ObjectCache::Load(const std::string& key) const
+{
+    auto path = directory / (key + ".o");
+    if (!std::filesystem::exists(path))
+        return {};
+
+    auto object = ReadFile(path);
+
+    // The modification time is when the object was last used, for pruning
+    std::error_code errorCode;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), errorCode);
+
+    return llvm::SmallVector<char, 0>(object.begin(), object.end());
+}
+
+void ObjectCache::Store(const std::string& key, const llvm::SmallVector<char, 0>& object) const
+{
+    // Objects are renamed into place, so another build reading the cache never sees half of one
+    auto path = directory / (key + ".o");
+    auto temporaryPath = directory / std::format("{}.{}.tmp", key, getpid());
+
+    {
+        std::ofstream file(temporaryPath, std::ios::binary);
+        file.write(object.data(), static_cast<long>(object.size()));
+        if (!file)
+            g_context->Error({}, "Can't write to cache directory {}", directory.string());
+    }
+
+    std::error_code errorCode;
+    std::filesystem::rename(temporaryPath, path, errorCode);
+    if (errorCode)
+        g_context->Error({}, "Can't write to cache directory {}: {}", directory.string(), errorCode.message());
+}
+
+void ObjectCache::Prune(const std::set<std::string>& usedKeys) const
+{
+    struct CachedObject
+    {
+        std::filesystem::path path;
+        std::filesystem::file_time_type lastUsed;
+        uint64_t size;
+    };
+
+    // NOTE: Other builds can share the directory and remove objects at the same time, so every error is ignored
+    std::error_code errorCode;
+    std::vector<CachedObject> unusedObjects;
+    uint64_t totalSize = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, errorCode))
+    {
+        if (entry.path().extension() != ".o")
+            continue;
+
+        auto size = entry.file_size(errorCode);
+        totalSize += size;
+        if (!usedKeys.contains(entry.path().stem().string()))
+            unusedObjects.push_back({entry.path(), entry.last_write_time(errorCode), size});
+    }
+
+    std::ranges::sort(unusedObjects, {}, &CachedObject::lastUsed);
+    for (const auto& object : unusedObjects)
+    {
+        if (totalSize <= maxSize)
+            break;
+
+        if (std::filesystem::remove(object.path, errorCode))
+            totalSize -= object.size;
+    }
+}
+
+std::vector<llvm::SmallVector<char, 0>> ObjectCache::Compile(uint32_t jobs, bool verify) const
+{
+    auto main = g_parsedFile->FindFunction("main");
+    if (!main || !main->block)
+        g_context->Error({}, "No main function found");
+
+    // The globals are one object, and every function is another
+    struct Unit
+    {
+        bool definesGlobals;
+        std::vector<Ref<FunctionAST>> functions;
+        std::string key;
+    };
+
+    std::vector<Unit> units;
+    units.push_back({true, {}, Key(true, {})});
+    for (const auto& function : g_parsedFile->functions)
+    {
+        if (function->block)
+            units.push_back({false, {function}, Key(false, {function})});
+    }
+
+    std::vector<llvm::SmallVector<char, 0>> objects(units.size());
+    std::vector<size_t> misses;
+    for (size_t i = 0; i < units.size(); i++)
+    {
+        if (auto object = Load(units[i].key))
+            objects[i] = std::move(*object);
+        else
+            misses.push_back(i);
+    }
+
+    auto parentContext = g_context;
+    auto parsedFile = g_parsedFile;
+    auto moduleName = parentContext->module->getName().str();
+    auto tracing = llvm::timeTraceProfilerEnabled();
+    std::atomic<size_t> nextMiss = 0;
+    std::vector<std::exception_ptr> errors(misses.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min<size_t>(jobs, misses.size()); i++)
+    {
+        workers.emplace_back(
+            [&]
+            {
+                ThreadTimeTrace threadTrace(tracing);
+                g_parsedFile = parsedFile;
+                for (auto miss = nextMiss++; miss < misses.size(); miss = nextMiss++)
+                {
+                    const auto& unit = units[misses[miss]];
+                    auto unitName = unit.definesGlobals ? std::string("globals") : unit.functions[0]->name;
+
+                    g_context = MakeRef<Context>(*parentContext, std::format("{}.{}", moduleName, unitName));
+                    g_context->CopyStructsFrom(*parentContext);
+
+                    try
+                    {
+                        g_parsedFile->CodegenPartition(unit.definesGlobals, unit.functions);
+                        g_context->Finalize();
+
+                        if (verify)
+                            g_context->Verify();
+
+                        g_context->Optimize();
+
+                        llvm::raw_svector_ostream stream(objects[misses[miss]]);
+                        g_context->Emit(stream, llvm::CodeGenFileType::ObjectFile);
+
+                        Store(unit.key, objects[misses[miss]]);
+                    }
+                    catch (const CompileError&)
+                    {
+                        errors[miss] = std::current_exception();
+                    }
+                }
+
+                g_context = nullptr;
+                g_parsedFile = nullptr;
+            });
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+
+    for (const auto& error : errors)
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    std::set<std::string> usedKeys;
+    for (const auto& unit : units)
+        usedKeys.insert(unit.key);
+    Prune(usedKeys);
+
+    return objects;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <AST.h>
+#include <filesystem>
+
+// Optimized objects from earlier builds, every function is its own object so that only the functions that
+// changed have to be generated again
+// NOTE: Nothing can be inlined across functions that end up in different objects
+struct ObjectCache
+{
+    static constexpr uint64_t defaultMaxSize = 1024 * 1024 * 1024;
+
+    ObjectCache(const std::filesystem::path& directory, uint64_t maxSize = defaultMaxSize);
+
+    std::filesystem::path directory;
+
+    // After every build, the least recently used objects are removed until the cache is at most this big
+    // NOTE: The objects of the build that just finished are always kept
+    uint64_t maxSize;
+
+    // Hash of everything that is the same for every object of this build: the compiler, the target, the options,
+    // the structs and the globals
+    std::string buildHash;
+
+    // Generates the objects that aren't in the cache yet on up to `jobs` threads, and returns all of them
+    std::vector<llvm::SmallVector<char, 0>> Compile(uint32_t jobs, bool verify) const;
+
+    std::string Key(bool definesGlobals, const std::vector<Ref<FunctionAST>>& functions) const;
+    std::optional<llvm::SmallVector<char, 0>> Load(const std::string& key) const;
+    void Store(const std::string& key, const llvm::SmallVector<char, 0>& object) const;
+    void Prune(const std::set<std::string>& usedKeys) const;
+};
@@ -1,4 +1,5 @@
 #include "Utils.h"
+#include <Interface.h>
 #include <Parser.h>
 #include <Type.h>
 #include <TypeCasts.h>
@@ -74,51 +75,15 @@ Ref<ParsedFile> Parser::Parse()
 
             ExpectToken(TokenType::RCurly);
 
-            std::vector<llvm::Type*> llvmMembers;
-            std::map<std::string, Ref<Type>> rawMembers;
-            std::vector<llvm::Metadata*> debugTypes;
-            uint64_t debugOffset = 0;
-            for (auto& [name, type] : members)
-            {
-                llvmMembers.push_back(type->GetType());
-                rawMembers[name] = type;
-                if (g_context->debug)
-                {
-                    auto file = nameToken.location.GetFile().debugFile;
-                    auto size = g_context->module->getDataLayout().getTypeAllocSizeInBits(type->GetType());
-                    debugTypes.push_back(g_context->debugBuilder->createMemberType(
-                        file, name, file, nameToken.location.line, size, 0, debugOffset, llvm::DINode::FlagZero, type->GetDebugType()));
-                    debugOffset += size;
-                }
-            }
-
-            if (llvmMembers.empty())
-            {
-                llvmMembers.push_back(llvm::Type::getInt8Ty(*g_context->llvmContext));
-                if (g_context->debug)
-                    debugTypes.push_back(g_context->debugBuilder->createBasicType("uint8", 8, llvm::dwarf::DW_ATE_unsigned));
-            }
-
-            auto llvmType = llvm::StructType::create(llvmMembers, nameToken.stringValue);
-
-            llvm::DICompositeType* debugType = nullptr;
-            if (g_context->debug)
-            {
-                auto file = nameToken.location.GetFile().debugFile;
-                debugType = g_context->debugBuilder->createStructType(
-                    file,
-                    nameToken.stringValue,
-                    file,
-                    nameToken.location.line,
-                    g_context->module->getDataLayout().getTypeAllocSizeInBits(llvmType),
-                    0,
-                    llvm::DINode::FlagPrototyped,
-                    nullptr,
-                    g_context->debugBuilder->getOrCreateArray(debugTypes));
-            }
+            g_context->AddStruct(nameToken.stringValue, members, nameToken.location);
+        }
+        else if (token.type == TokenType::Import)
+        {
+            auto path = m_stream.NextToken();
+            if (path.type != TokenType::StringLiteral)
+                g_context->Error(path.location, "Expected string literal after import");
 
-            g_context->structs[nameToken.stringValue] = {
-                .name = nameToken.stringValue, .members = rawMembers, .llvmType = llvmType, .debugType = debugType};
+            ImportInterface(path.stringValue, path.location, functions, globalVariables);
         }
         else if (token.type == TokenType::Var || token.type == TokenType::Const)
         {
@@ -1,7 +1,7 @@
 #include <Lexer.h>
 #include <Preprocessor.h>
 
-static std::vector<uint32_t> g_includedFiles;
+static thread_local std::vector<uint32_t> g_includedFiles;
 
 TokenStream PreprocessSubfile(TokenStream stream);
 
@@ -87,6 +87,7 @@ TokenStream PreprocessSubfile(TokenStream stream)
 
 TokenStream Preprocess(TokenStream stream)
 {
+    g_includedFiles.clear();
     IncludeFile(stream, "Prelude");
     return std::move(PreprocessSubfile(std::move(stream)));
 }
@@ -0,0 +1,186 @@
+#include <Context.h>
+#include <Server.h>
+
+#include <csignal>
+#include <cstring>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/TargetParser/Host.h>
+#include <span>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+[[nodiscard]] static bool ReadAll(int fd, char* data, size_t size)
+{
+    while (size > 0)
+    {
+        auto result = read(fd, data, size);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            return false;
+
+        data += result;
+        size -= result;
+    }
+
+    return true;
+}
+
+// Runs in a fork of the server, it compiles in another fork so it can report how that one exited
+[[noreturn]] static void ServeRequest(int connection, const CompileFunction& compile)
+{
+    // NOTE: The server ignores SIGCHLD so it doesn't have to reap us, but we have to wait for the compiler
+    signal(SIGCHLD, SIG_DFL);
+
+    // The socket is only accessible to our user, this is in case its permissions were changed
+    ucred credentials{};
+    socklen_t credentialsSize = sizeof(credentials);
+    if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &credentialsSize) != 0 || credentials.uid != getuid())
+        _exit(1);
+
+    uint32_t size;
+    iovec sizeVector{&size, sizeof(size)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * passedFileDescriptorCount)];
+    msghdr message{};
+    message.msg_iov = &sizeVector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    auto received = recvmsg(connection, &message, MSG_CMSG_CLOEXEC);
+    auto* controlMessage = CMSG_FIRSTHDR(&message);
+    if (received != sizeof(size) || !controlMessage || controlMessage->cmsg_type != SCM_RIGHTS ||
+        controlMessage->cmsg_len != CMSG_LEN(sizeof(int) * passedFileDescriptorCount))
+        _exit(1);
+
+    int fileDescriptors[passedFileDescriptorCount];
+    memcpy(fileDescriptors, CMSG_DATA(controlMessage), sizeof(fileDescriptors));
+
+    std::string request(size, '\0');
+    if (!ReadAll(connection, request.data(), request.size()))
+        _exit(1);
+
+    std::vector<std::string> strings;
+    for (size_t start = 0; start < request.size();)
+    {
+        auto end = request.find('\0', start);
+        if (end == std::string::npos)
+            _exit(1);
+
+        strings.push_back(request.substr(start, end - start));
+        start = end + 1;
+    }
+
+    if (strings.size() < 2)
+        _exit(1);
+
+    auto compiler = fork();
+    if (compiler == 0)
+    {
+        close(connection);
+        for (int i = 0; i < passedFileDescriptorCount; i++)
+            dup2(fileDescriptors[i], i);
+
+        if (chdir(strings[0].c_str()) != 0)
+        {
+            std::println(std::cerr, "Can't change to directory {}: {}", strings[0], strerror(errno));
+            exit(1);
+        }
+
+        // A request is one build, it can't become another server or keep watching inside the server
+        for (std::string_view argument : std::span(strings).subspan(1))
+        {
+            if (argument == "--server" || argument.starts_with("--server=") || argument == "--watch")
+            {
+                std::println(std::cerr, "{} can't be used through the server", argument.substr(0, argument.find('=')));
+                exit(1);
+            }
+        }
+
+        exit(compile({strings.begin() + 1, strings.end()}));
+    }
+
+    for (int fileDescriptor : fileDescriptors)
+        close(fileDescriptor);
+
+    int status = 0;
+    if (compiler < 0 || waitpid(compiler, &status, 0) < 0)
+        _exit(1);
+
+    int32_t exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    if (write(connection, &exitCode, sizeof(exitCode)) != sizeof(exitCode))
+        _exit(1);
+
+    _exit(0);
+}
+
+void RunServer(const std::string& socketPath, const CompileFunction& compile)
+{
+    // Everything done here is inherited by the forks, so the requests don't have to do it again
+    Context::InitializeTargets();
+
+    std::string error;
+    auto targetTriple = llvm::sys::getDefaultTargetTriple();
+    if (auto target = llvm::TargetRegistry::lookupTarget(targetTriple, error))
+        delete target->createTargetMachine(targetTriple, llvm::sys::getHostCPUName(), "", {}, {});
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        std::println(std::cerr, "Socket path is too long: {}", socketPath);
+        exit(1);
+    }
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    // A socket left behind by an earlier server is replaced, but anything else at the path is a mistake
+    struct stat existing;
+    if (lstat(socketPath.c_str(), &existing) == 0)
+    {
+        if (!S_ISSOCK(existing.st_mode))
+        {
+            std::println(std::cerr, "{} already exists and isn't a socket", socketPath);
+            exit(1);
+        }
+
+        unlink(socketPath.c_str());
+    }
+
+    // NOTE: Clients choose the directory and the arguments of the build, so only our user may connect
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    auto oldMask = umask(0177);
+    bool bound = listener >= 0 && bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+    umask(oldMask);
+    if (!bound || chmod(socketPath.c_str(), 0600) != 0 || listen(listener, SOMAXCONN) != 0)
+    {
+        std::println(std::cerr, "Can't listen on {}: {}", socketPath, strerror(errno));
+        exit(1);
+    }
+
+    // Requests report their own exit codes to their clients, so nobody has to wait for them
+    signal(SIGCHLD, SIG_IGN);
+
+    while (true)
+    {
+        int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            std::println(std::cerr, "Can't accept connections on {}: {}", socketPath, strerror(errno));
+            exit(1);
+        }
+
+        if (fork() == 0)
+        {
+            close(listener);
+            ServeRequest(connection, compile);
+        }
+
+        close(connection);
+    }
+}
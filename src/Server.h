@@ -0,0 +1,18 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// How NeonClient talks to `neon --server`:
+// - The client sends a uint32_t size with its stdin, stdout and stderr attached (SCM_RIGHTS), followed by
+//   that many bytes of its working directory and its arguments, each terminated by a null
+// - The server compiles in a fork of itself with the client's streams and directory, and replies with an
+//   int32_t exit code once the compiler (or the program started by --run) exits
+constexpr int passedFileDescriptorCount = 3;
+
+using CompileFunction = std::function<int(const std::vector<std::string>& arguments)>;
+
+// Every request is served by a fork of the server, so they run concurrently, share the already initialized
+// LLVM, and an error in one of them can't take down the server
+[[noreturn]] void RunServer(const std::string& socketPath, const CompileFunction& compile);
@@ -0,0 +1,188 @@
+#include <Timing.h>
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <print>
+
+// In microseconds, shorter spans are left out of the trace
+// NOTE: Every function is kept, the ones that are quick to compile add up in big programs
+static constexpr unsigned timeTraceGranularity = 0;
+
+// Phases are timed on the thread that started the build, passes on every thread
+static thread_local bool t_timingPhases = false;
+static std::atomic<bool> timingPasses = false;
+
+// The passes of every pipeline of the build, added up
+static std::mutex passTimesMutex;
+static llvm::StringMap<llvm::TimeRecord> passTimes;
+static llvm::StringMap<llvm::TimeRecord> analysisTimes;
+
+static void AddTimes(llvm::StringMap<llvm::TimeRecord>& times, const llvm::StringMap<llvm::TimeRecord>& other)
+{
+    for (const auto& entry : other)
+        times[entry.getKey()] += entry.getValue();
+}
+
+static void PrintTimes(llvm::StringMap<llvm::TimeRecord>& times, llvm::StringRef name, llvm::StringRef description)
+{
+    if (!times.empty())
+        llvm::TimerGroup(name, description, times).print(llvm::errs());
+
+    times.clear();
+}
+
+BuildTimer::BuildTimer(bool report, std::optional<std::string> traceFilename)
+    : m_report(report)
+    , m_traceFilename(std::move(traceFilename))
+{
+    t_timingPhases = m_report;
+    timingPasses = m_report;
+
+    if (m_traceFilename)
+        llvm::timeTraceProfilerInitialize(timeTraceGranularity, "neon");
+}
+
+BuildTimer::~BuildTimer()
+{
+    Finish();
+}
+
+void BuildTimer::Finish()
+{
+    if (m_finished)
+        return;
+
+    m_finished = true;
+
+    // The passes of every pipeline and the phases are reported together at the end
+    if (m_report)
+    {
+        t_timingPhases = false;
+        timingPasses = false;
+
+        std::lock_guard lock(passTimesMutex);
+        PrintTimes(passTimes, "pass", "Pass execution timing report");
+        PrintTimes(analysisTimes, "analysis", "Analysis execution timing report");
+        llvm::TimerGroup::printAll(llvm::errs());
+    }
+
+    if (m_traceFilename)
+    {
+        if (auto error = llvm::timeTraceProfilerWrite(*m_traceFilename, "neon"))
+            std::println(std::cerr, "Can't write time trace {}: {}", *m_traceFilename, llvm::toString(std::move(error)));
+
+        llvm::timeTraceProfilerCleanup();
+    }
+}
+
+PhaseTimer::PhaseTimer(llvm::StringRef name)
+    : m_traceScope(name)
+    , m_timer(name, name, "neon", "Compilation phases", t_timingPhases)
+{
+}
+
+PipelineTimer::PipelineTimer(llvm::PassInstrumentationCallbacks& callbacks)
+{
+    if (!timingPasses)
+        return;
+
+    // NOTE: Pass managers and adaptors only run other passes, like LLVM's own timers they are left out
+    auto isPass = [](llvm::StringRef name)
+    {
+        return !llvm::isSpecialPass(
+            name, {"PassManager", "PassAdaptor", "AnalysisManagerProxy", "ModuleInlinerWrapperPass", "DevirtSCCRepeatedPass"});
+    };
+
+    callbacks.registerBeforeNonSkippedPassCallback(
+        [this, isPass](llvm::StringRef name, llvm::Any)
+        {
+            if (isPass(name))
+                Start(name, m_passTimes);
+        });
+    callbacks.registerAfterPassCallback(
+        [this, isPass](llvm::StringRef name, llvm::Any, const llvm::PreservedAnalyses&)
+        {
+            if (isPass(name))
+                Stop();
+        });
+    callbacks.registerAfterPassInvalidatedCallback(
+        [this, isPass](llvm::StringRef name, const llvm::PreservedAnalyses&)
+        {
+            if (isPass(name))
+                Stop();
+        });
+    callbacks.registerBeforeAnalysisCallback([this](llvm::StringRef name, llvm::Any) { Start(name, m_analysisTimes); });
+    callbacks.registerAfterAnalysisCallback([this](llvm::StringRef, llvm::Any) { Stop(); });
+}
+
+PipelineTimer::~PipelineTimer()
+{
+    if (m_passTimes.empty() && m_analysisTimes.empty())
+        return;
+
+    std::lock_guard lock(passTimesMutex);
+    AddTimes(passTimes, m_passTimes);
+    AddTimes(analysisTimes, m_analysisTimes);
+}
+
+void PipelineTimer::Start(llvm::StringRef name, llvm::StringMap<llvm::TimeRecord>& times)
+{
+    auto now = llvm::TimeRecord::getCurrentTime(true);
+    if (!m_running.empty())
+    {
+        auto& outer = m_running.back();
+        auto elapsed = now;
+        elapsed -= outer.start;
+        (*outer.times)[outer.name] += elapsed;
+    }
+
+    m_running.push_back({&times, name.str(), now});
+}
+
+void PipelineTimer::Stop()
+{
+    if (m_running.empty())
+        return;
+
+    auto now = llvm::TimeRecord::getCurrentTime(false);
+    auto& running = m_running.back();
+    auto elapsed = now;
+    elapsed -= running.start;
+    (*running.times)[running.name] += elapsed;
+    m_running.pop_back();
+
+    if (!m_running.empty())
+        m_running.back().start = now;
+}
+
+CodegenTimer::CodegenTimer()
+{
+    if (timingPasses)
+        m_start = llvm::TimeRecord::getCurrentTime(true);
+}
+
+CodegenTimer::~CodegenTimer()
+{
+    if (!m_start)
+        return;
+
+    auto elapsed = llvm::TimeRecord::getCurrentTime(false);
+    elapsed -= *m_start;
+
+    std::lock_guard lock(passTimesMutex);
+    passTimes["CodeGen (every machine pass)"] += elapsed;
+}
+
+ThreadTimeTrace::ThreadTimeTrace(bool enabled)
+    : m_enabled(enabled)
+{
+    if (m_enabled)
+        llvm::timeTraceProfilerInitialize(timeTraceGranularity, "neon");
+}
+
+ThreadTimeTrace::~ThreadTimeTrace()
+{
+    if (m_enabled)
+        llvm::timeTraceProfilerFinishThread();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/IR/PassInstrumentation.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/Timer.h>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+// --time-report prints the wall and CPU time of every phase of a build, of every optimization pass and of code generation
+// --time-trace writes the phases, the passes and every function that was typechecked, generated or optimized as a
+// Chrome trace, for chrome://tracing or ui.perfetto.dev
+
+// Turns the report and the trace on for one build, and reports and writes them when it's finished
+class BuildTimer
+{
+public:
+    BuildTimer(bool report, std::optional<std::string> traceFilename);
+    ~BuildTimer();
+
+    // Called by the destructor, the driver only calls it before replacing itself with the program it built
+    void Finish();
+
+private:
+    bool m_report;
+    std::optional<std::string> m_traceFilename;
+    bool m_finished = false;
+};
+
+// Times every pass and analysis an optimization pipeline runs, on any thread, and adds them to the build's report
+// NOTE: LLVM's pass timers can't be shared by threads and print a table each, so the times of every pipeline are
+//       added up instead, and reported together when the build is finished
+class PipelineTimer
+{
+public:
+    // Does nothing without --time-report
+    explicit PipelineTimer(llvm::PassInstrumentationCallbacks& callbacks);
+    ~PipelineTimer();
+
+private:
+    struct RunningPass
+    {
+        llvm::StringMap<llvm::TimeRecord>* times;
+        std::string name;
+        llvm::TimeRecord start;
+    };
+
+    void Start(llvm::StringRef name, llvm::StringMap<llvm::TimeRecord>& times);
+    void Stop();
+
+    // Passes run analyses and other passes, only the innermost one is timed
+    std::vector<RunningPass> m_running;
+    llvm::StringMap<llvm::TimeRecord> m_passTimes;
+    llvm::StringMap<llvm::TimeRecord> m_analysisTimes;
+};
+
+// Times generating machine code, on any thread, for the build's report
+// NOTE: The legacy pass manager that does it can't be instrumented, so it's reported as one pass
+class CodegenTimer
+{
+public:
+    CodegenTimer();
+    ~CodegenTimer();
+
+private:
+    std::optional<llvm::TimeRecord> m_start;
+};
+
+// Times a phase for the report, and adds it to the trace
+// NOTE: LLVM timers can't be shared by threads, so phases are only timed on the thread that started the build
+class PhaseTimer
+{
+public:
+    explicit PhaseTimer(llvm::StringRef name);
+
+private:
+    llvm::TimeTraceScope m_traceScope;
+    llvm::NamedRegionTimer m_timer;
+};
+
+// The trace is per thread, so threads started by a build record their own and add it to the build's when they finish
+// `enabled` is whether the thread that started this one is tracing
+class ThreadTimeTrace
+{
+public:
+    explicit ThreadTimeTrace(bool enabled);
+    ~ThreadTimeTrace();
+
+private:
+    bool m_enabled;
+};
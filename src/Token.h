@@ -43,6 +43,7 @@ enum class TokenType
     Extern,
     While,
     Include,
+    Import,
     Struct,
     Var,
     Const,
@@ -69,7 +70,7 @@ struct std::formatter<TokenType>
 
     auto format(const TokenType& obj, std::format_context& ctx) const
     {
-        static_assert(static_cast<uint32_t>(TokenType::_TokenTypeCount) == 39, "Not all tokens are handled in TokenType formatter");
+        static_assert(static_cast<uint32_t>(TokenType::_TokenTypeCount) == 40, "Not all tokens are handled in TokenType formatter");
         std::string str = "???";
 
         switch (obj)
@@ -109,6 +110,7 @@ struct std::formatter<TokenType>
             case Extern:             str = "Extern"; break;
             case While:              str = "While"; break;
             case Include:            str = "Include"; break;
+            case Import:             str = "Import"; break;
             case Struct:             str = "Struct"; break;
             case Var:                str = "Var"; break;
             case Const:              str = "Const"; break;
@@ -128,7 +130,7 @@ struct std::formatter<Token>
 
     auto format(const Token& obj, std::format_context& ctx) const
     {
-        static_assert(static_cast<uint32_t>(TokenType::_TokenTypeCount) == 39, "Not all tokens are handled in Token formatter");
+        static_assert(static_cast<uint32_t>(TokenType::_TokenTypeCount) == 40, "Not all tokens are handled in Token formatter");
         std::string str = "???";
 
         switch (obj.type)
@@ -168,6 +170,7 @@ struct std::formatter<Token>
             case Extern:             str = "Extern (`extern`)"; break;
             case While:              str = "While (`while`)"; break;
             case Include:            str = "Include (`include`)"; break;
+            case Import:             str = "Import (`import`)"; break;
             case Struct:             str = "Struct (`struct`)"; break;
             case Var:                str = "Var (`var`)"; break;
             case Const:              str = "Const (`const`)"; break;
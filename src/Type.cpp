@@ -180,8 +180,7 @@ llvm::Constant* StructType::GetDefaultValue() const
 
 llvm::Constant* VoidType::GetDefaultValue() const
 {
-    std::println(std::cerr, "COMPILER ERROR: Can't get default value for void type");
-    exit(1);
+    g_context->Error({}, "COMPILER ERROR: Can't get default value for void type");
 }
 
 // --------------------------
@@ -2,6 +2,11 @@
 #include <Utils.h>
 #include <filesystem>
 #include <fstream>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Object/BuildID.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SHA256.h>
 
 Location::Location(uint32_t fileID, size_t index)
 {
@@ -30,3 +35,30 @@ std::vector<char> ReadFile(const std::filesystem::path& filename)
 
     return result;
 }
+
+// NOTE: This can run before there is a context, so nothing here can be reported as an error
+[[nodiscard]] static std::string ReadCompilerIdentity()
+{
+    auto buffer = llvm::MemoryBuffer::getFile("/proc/self/exe", false, false);
+    if (!buffer)
+        return "unknown";
+
+    auto object = llvm::object::ObjectFile::createObjectFile((*buffer)->getMemBufferRef());
+    if (object)
+    {
+        if (auto buildID = llvm::object::getBuildID(object->get()); !buildID.empty())
+            return "build-id:" + llvm::toHex(buildID, true);
+    }
+    else
+    {
+        llvm::consumeError(object.takeError());
+    }
+
+    return "sha256:" + llvm::toHex(llvm::SHA256::hash(llvm::arrayRefFromStringRef((*buffer)->getBuffer())), true);
+}
+
+const std::string& CompilerIdentity()
+{
+    static const std::string identity = ReadCompilerIdentity();
+    return identity;
+}
@@ -60,3 +60,7 @@ struct Location
 };
 
 std::vector<char> ReadFile(const std::filesystem::path& filename);
+
+// The build ID of the running compiler, or a hash of the whole binary when it has none
+// NOTE: A rebuilt compiler can generate different code from the same input, so this is part of every cache key
+const std::string& CompilerIdentity();
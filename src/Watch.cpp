@@ -0,0 +1,142 @@
+#include <Watch.h>
+
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <poll.h>
+#include <print>
+#include <set>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// The signal that ended watching, 0 until then
+static volatile sig_atomic_t interrupted = 0;
+
+static void Build(const std::vector<std::string>& arguments, const CompileFunction& compile)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    auto compiler = fork();
+    if (compiler == 0)
+    {
+        for (int stopSignal : {SIGINT, SIGTERM, SIGHUP})
+            signal(stopSignal, SIG_DFL);
+        exit(compile(arguments));
+    }
+
+    // NOTE: Without a compiler that exited, the build failed, the status would otherwise look like a success
+    bool succeeded = false;
+    if (compiler < 0)
+    {
+        std::println(std::cerr, "Can't start the compiler: {}", strerror(errno));
+    }
+    else
+    {
+        int status;
+        int waited;
+        while ((waited = waitpid(compiler, &status, 0)) < 0 && errno == EINTR)
+        {
+        }
+
+        if (waited < 0)
+            std::println(std::cerr, "Can't wait for the compiler: {}", strerror(errno));
+        else
+            succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    if (succeeded)
+        std::println(std::cerr, "Built in {} ms, watching for changes", milliseconds);
+    else
+        std::println(std::cerr, "Build failed after {} ms, watching for changes", milliseconds);
+}
+
+// Blocks until a source file changes, editors save in several steps so the events are collected until it's quiet
+// Returns false when interrupted
+[[nodiscard]] static bool WaitForChange(int inotify)
+{
+    bool changed = false;
+    while (!interrupted)
+    {
+        pollfd pollDescriptor{inotify, POLLIN, 0};
+        auto ready = poll(&pollDescriptor, 1, changed ? 50 : -1);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready < 0)
+        {
+            std::println(std::cerr, "Can't watch for changes: {}", strerror(errno));
+            exit(1);
+        }
+        if (ready == 0)
+            return true;
+
+        alignas(inotify_event) char events[4096];
+        auto length = read(inotify, events, sizeof(events));
+        for (ssize_t offset = 0; offset < length;)
+        {
+            auto* event = reinterpret_cast<inotify_event*>(events + offset);
+            if (event->len > 0 && std::string_view(event->name).ends_with(".ne"))
+                changed = true;
+            offset += sizeof(inotify_event) + event->len;
+        }
+    }
+
+    return false;
+}
+
+void RunWatch(
+    const std::vector<std::string>& filenames, std::vector<std::string> arguments, bool keepObjects, const CompileFunction& compile)
+{
+    // NOTE: Stopping the watch any way but SIGKILL or a crash removes the objects
+    struct sigaction interruptAction{};
+    interruptAction.sa_handler = [](int stopSignal) { interrupted = stopSignal; };
+    for (int stopSignal : {SIGINT, SIGTERM, SIGHUP})
+        sigaction(stopSignal, &interruptAction, nullptr);
+
+    // NOTE: Editors often replace files instead of writing to them, so the directories are watched
+    //       Includes always come from lib/, so these are all the files a build can load
+    std::set<std::filesystem::path> directories = {"lib"};
+    for (const auto& filename : filenames)
+    {
+        auto directory = std::filesystem::path(filename).parent_path();
+        directories.insert(directory.empty() ? std::filesystem::path(".") : directory);
+    }
+
+    int inotify = inotify_init1(IN_CLOEXEC);
+    for (const auto& watched : directories)
+    {
+        if (inotify < 0 || inotify_add_watch(inotify, watched.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE) < 0)
+        {
+            std::println(std::cerr, "Can't watch {}: {}", watched.string(), strerror(errno));
+            exit(1);
+        }
+    }
+
+    std::string objectsDirectory;
+    if (keepObjects)
+    {
+        auto memory =
+            std::filesystem::is_directory("/dev/shm") ? std::filesystem::path("/dev/shm") : std::filesystem::temp_directory_path();
+        objectsDirectory = (memory / "neon-watch-XXXXXX").string();
+        if (!mkdtemp(objectsDirectory.data()))
+        {
+            std::println(std::cerr, "Can't create a directory for objects: {}", strerror(errno));
+            exit(1);
+        }
+
+        // Only the objects of the last build can be reused by the next one, everything else is removed from memory
+        arguments.insert(arguments.end(), {"--cache-dir", objectsDirectory, "--cache-max-size", "0"});
+    }
+
+    Build(arguments, compile);
+    while (WaitForChange(inotify))
+        Build(arguments, compile);
+
+    if (keepObjects)
+        std::filesystem::remove_all(objectsDirectory);
+
+    exit(128 + interrupted);
+}
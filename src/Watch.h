@@ -0,0 +1,9 @@
+#pragma once
+
+#include <Server.h>
+
+// Builds with `arguments` every time a source file next to one of `filenames` or in lib/ changes, until interrupted
+// Every build runs in a fork, so an error doesn't end watching. With `keepObjects`, the objects of unchanged
+// functions are kept in memory (an object cache on tmpfs) and only the changed functions are generated again
+[[noreturn]] void RunWatch(
+    const std::vector<std::string>& filenames, std::vector<std::string> arguments, bool keepObjects, const CompileFunction& compile);
@@ -1,24 +1,163 @@
-#include <Context.h>
+#include <Compilation.h>
+#include <Dependencies.h>
 #include <Lexer.h>
-#include <Parser.h>
+#include <ObjectCache.h>
 #include <Preprocessor.h>
+#include <Server.h>
+#include <Timing.h>
+#include <Watch.h>
 
+#include <algorithm>
 #include <argparse/argparse.hpp>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <thread>
+#include <unistd.h>
 
-int main(int argc, char** argv)
+static llvm::OptimizationLevel OptimizationLevelFromArgs(const argparse::ArgumentParser& program)
+{
+    if (program["-O1"] == true)
+        return llvm::OptimizationLevel::O1;
+    if (program["-O"] == true || program["-O2"] == true)
+        return llvm::OptimizationLevel::O2;
+    if (program["-O3"] == true)
+        return llvm::OptimizationLevel::O3;
+    if (program["-Os"] == true)
+        return llvm::OptimizationLevel::Os;
+    if (program["-Oz"] == true)
+        return llvm::OptimizationLevel::Oz;
+    return llvm::OptimizationLevel::O0;
+}
+
+static std::optional<llvm::PGOOptions> PGOOptionsFromArgs(const argparse::ArgumentParser& program)
+{
+    if (program["-fprofile-generate"] == true)
+        return llvm::PGOOptions("default_%m.profraw", "", "", "", llvm::vfs::getRealFileSystem(), llvm::PGOOptions::IRInstr);
+
+    if (auto profile = program.present("-fprofile-use"))
+    {
+        if (!std::filesystem::exists(*profile))
+        {
+            std::println(std::cerr, "Can't find profile: {}", *profile);
+            exit(1);
+        }
+
+        return llvm::PGOOptions(*profile, "", "", "", llvm::vfs::getRealFileSystem(), llvm::PGOOptions::IRUse);
+    }
+
+    return {};
+}
+
+// argparse only splits --option=value, but GCC-style options like -fprofile-use=file have a single dash
+static std::vector<std::string> SplitSingleDashAssignments(const std::vector<std::string>& passedArguments)
+{
+    std::vector<std::string> arguments;
+    for (std::string_view argument : passedArguments)
+    {
+        auto assignment = argument.find('=');
+        if (argument.starts_with("-f") && assignment != std::string_view::npos)
+        {
+            arguments.emplace_back(argument.substr(0, assignment));
+            arguments.emplace_back(argument.substr(assignment + 1));
+        }
+        else
+        {
+            arguments.emplace_back(argument);
+        }
+    }
+
+    return arguments;
+}
+
+static int Run(const std::vector<std::string>& arguments);
+
+static int PrintErrors(const Compilation& compilation)
+{
+    for (const auto& error : compilation.errors)
+        std::println(std::cerr, "{}", error.what());
+
+    return 1;
+}
+
+// A module's interface is an output too, `import "name"` reads name.nei, so it goes next to the object
+[[nodiscard]] static std::vector<std::string> OutputFilenames(const std::string& outputFilename, const argparse::ArgumentParser& program)
+{
+    if (program["--module"] == false)
+        return {outputFilename};
+
+    return {outputFilename, std::filesystem::path(outputFilename).replace_extension(".nei").string()};
+}
+
+static int Compile(const std::vector<std::string>& arguments)
 {
     argparse::ArgumentParser program("neon");
 
-    program.add_argument("filename").help("input file");
+    program.add_argument("filenames").help("input files, compiled into one program").nargs(argparse::nargs_pattern::any);
     program.add_argument("-o").help("output file");
     program.add_argument("-c").help("compile to object file").flag();
+    program.add_argument("--module").help("compile a module without main for `import`, to an object and an interface (.nei)").flag();
+    program.add_argument("--import-path")
+        .help("directory to look for the interfaces of imported modules in, can be repeated")
+        .append()
+        .default_value(std::vector<std::string>{});
+    program.add_argument("--emit-bc").help("compile to LLVM bitcode").flag();
+    program.add_argument("-flto").help("link time optimization, only thin is supported");
+    program.add_argument("--link")
+        .help("object, archive or bitcode file to link into the executable, can be repeated")
+        .append()
+        .default_value(std::vector<std::string>{});
     program.add_argument("-r", "--run").help("run executable").flag();
     program.add_argument("--target").help("target triple");
+    program.add_argument("-mattr").help("target features, e.g. +avx2,+bmi2");
+    program.add_argument("-ffunction-sections").help("place each function in its own section").flag();
+    program.add_argument("-fdata-sections").help("place each global in its own section").flag();
+    program.add_argument("-fno-omit-frame-pointer").help("keep frame pointers for profilers").flag();
+    program.add_argument("-funwind-tables").help("emit unwind tables (.eh_frame) for every function").flag();
+    program.add_argument("--size-report").help("list the size of every function and global in the output").flag();
+    program.add_argument("--freestanding").help("build a static executable that doesn't use libc").flag();
     program.add_argument("--disable-dce").help("disable dead code elimination").flag();
+    program.add_argument("--verify-ir").help("check the generated IR for compiler bugs").flag();
+    program.add_argument("--watch").help("build again whenever a source file changes, reusing unchanged functions").flag();
+    program.add_argument("--server").help("keep LLVM initialized and compile for NeonClient connecting to this Unix socket");
+    program.add_argument("--cache-dir").help("reuse the objects of functions that didn't change since an earlier build");
+    program.add_argument("--cache-max-size")
+        .help("in MiB, the least recently used objects are removed from --cache-dir when it gets bigger")
+        .scan<'u', uint64_t>()
+        .default_value(ObjectCache::defaultMaxSize / (1024 * 1024));
+    program.add_argument("--streaming")
+        .help("generate and emit the program in batches of functions, freeing each one, to bound memory on big programs")
+        .flag();
+    program.add_argument("--time-report").help("print the wall and CPU time of every phase, optimization pass and code generation").flag();
+    program.add_argument("--time-trace").help("write a Chrome trace of the phases, LLVM passes and functions to this file");
+    program.add_argument("-MD").help("write a Makefile rule listing every file the output depends on to <output>.d").flag();
+    program.add_argument("-MF").help("write the rule of -MD to this file instead");
+    program.add_argument("--skip-if-up-to-date")
+        .help("don't compile when the inputs and arguments are the same as when the output was written")
+        .flag();
+    program.add_argument("-j")
+        .help("number of threads to generate and emit code on, 0 for one per core")
+        .scan<'u', uint32_t>()
+        .default_value(1u);
+
+    auto& cpuGroup = program.add_mutually_exclusive_group();
+    cpuGroup.add_argument("-mcpu").help("target CPU, or native for the host CPU");
+    cpuGroup.add_argument("-march=native").help("target the host CPU and its features").flag();
+
+    auto& optimizeGroup = program.add_mutually_exclusive_group();
+    optimizeGroup.add_argument("-O").help("optimize (same as -O2)").flag();
+    optimizeGroup.add_argument("-O0").help("disable optimizations").flag();
+    optimizeGroup.add_argument("-O1").help("optimize lightly").flag();
+    optimizeGroup.add_argument("-O2").help("optimize").flag();
+    optimizeGroup.add_argument("-O3").help("optimize aggressively").flag();
+    optimizeGroup.add_argument("-Os").help("optimize for size").flag();
+    optimizeGroup.add_argument("-Oz").help("optimize aggressively for size").flag();
 
-    auto& optimizeDebugGroup = program.add_mutually_exclusive_group();
-    optimizeDebugGroup.add_argument("-O").help("optimize").flag();
-    optimizeDebugGroup.add_argument("-g").help("add debug information").flag();
+    auto& debugGroup = program.add_mutually_exclusive_group();
+    debugGroup.add_argument("-g").help("add debug information").flag();
+    debugGroup.add_argument("-gline-tables-only").help("add only function and line debug information").flag();
+
+    auto& profileGroup = program.add_mutually_exclusive_group();
+    profileGroup.add_argument("-fprofile-generate").help("instrument the program to write a profile when it exits").flag();
+    profileGroup.add_argument("-fprofile-use").help("optimize using a profile merged with llvm-profdata");
 
     auto& dumpGroup = program.add_mutually_exclusive_group();
     dumpGroup.add_argument("--dump-tokens-before-preprocessor").help("dump tokens before preprocessor").flag();
@@ -29,7 +168,7 @@ int main(int argc, char** argv)
 
     try
     {
-        program.parse_args(argc, argv);
+        program.parse_args(SplitSingleDashAssignments(arguments));
     }
     catch (const std::runtime_error& err)
     {
@@ -38,30 +177,97 @@ int main(int argc, char** argv)
         exit(1);
     }
 
-    g_context = MakeRef<Context>(program.get("filename"), program.present("--target"), program["-O"] == true, program["-g"] == true);
+    if (auto socketPath = program.present("--server"))
+        RunServer(*socketPath, Run);
 
-    auto tokenStream = CreateTokenStream(g_context->rootFileID);
+    auto filenames = program.get<std::vector<std::string>>("filenames");
+    if (filenames.empty())
+    {
+        std::println(std::cerr, "No input file");
+        std::cout << program;
+        exit(1);
+    }
 
-    if (program["--dump-tokens-before-preprocessor"] == true)
+    if (program["--watch"] == true)
     {
-        tokenStream.Dump();
-        return 0;
+        std::vector<std::string> buildArguments;
+        std::ranges::copy_if(arguments, std::back_inserter(buildArguments), [](const auto& argument) { return argument != "--watch"; });
+
+        // Only executables can be put together from the objects of single functions
+        bool keepObjects = program["-c"] == false && program["--module"] == false && program["--emit-bc"] == false &&
+                           !program.present("-flto") && !program.present("--cache-dir") && program["--streaming"] == false &&
+                           program["--dump-ir"] == false && program["--dump-asm"] == false;
+        RunWatch(filenames, buildArguments, keepObjects, Run);
+    }
+
+    if (auto lto = program.present("-flto"); lto.has_value() && lto.value() != "thin")
+    {
+        std::println(std::cerr, "Unsupported LTO mode: {}, only thin is supported", lto.value());
+        exit(1);
     }
 
-    tokenStream = Preprocess(std::move(tokenStream));
+    auto fileType = Context::OutputFileType::Executable;
+    if (program["--emit-bc"] == true)
+        fileType = Context::OutputFileType::Bitcode;
+    else if (program["-c"] == true || program["--module"] == true)
+        fileType = Context::OutputFileType::Object;
 
-    if (program["--dump-tokens"] == true)
+    if (program["--run"] == true && fileType != Context::OutputFileType::Executable)
     {
+        std::println(std::cerr, "--run can only be used when building an executable");
+        exit(1);
+    }
+
+    // Running, reporting, timing and dumping need the compiled program, so only plain builds are skipped
+    bool isPlainBuild = program["--run"] == false && program["--size-report"] == false && program["--time-report"] == false &&
+                        !program.present("--time-trace") && program["--dump-tokens-before-preprocessor"] == false &&
+                        program["--dump-tokens"] == false && program["--dump-ast"] == false && program["--dump-ir"] == false &&
+                        program["--dump-asm"] == false;
+    if (program["--skip-if-up-to-date"] == true && isPlainBuild &&
+        IsUpToDate(OutputFilenames(Context::OutputFilename(filenames[0], fileType, program.present("-o")), program), arguments))
+        return 0;
+
+    BuildTimer buildTimer(program["--time-report"] == true, program.present("--time-trace"));
+
+    llvm::TargetOptions targetOptions;
+    targetOptions.FunctionSections = program["-ffunction-sections"] == true;
+    targetOptions.DataSections = program["-fdata-sections"] == true;
+
+    Compilation compilation(
+        MakeRef<Context>(
+            filenames[0],
+            ContextOptions{
+                .target = program.present("--target"),
+                .cpu = program["-march=native"] == true ? std::optional<std::string>("native") : program.present("-mcpu"),
+                .features = program.present("-mattr"),
+                .targetOptions = targetOptions,
+                .optimizationLevel = OptimizationLevelFromArgs(program),
+                .pgoOptions = PGOOptionsFromArgs(program),
+                .thinLTO = program.present("-flto").has_value(),
+                .debug = program["-g"] == true || program["-gline-tables-only"] == true,
+                .debugLineTablesOnly = program["-gline-tables-only"] == true,
+                .freestanding = program["--freestanding"] == true,
+                .framePointers = program["-fno-omit-frame-pointer"] == true,
+                .unwindTables = program["-funwind-tables"] == true,
+                .discardValueNames = program["--dump-ir"] == false,
+            }),
+        {filenames.begin() + 1, filenames.end()});
+
+    if (program["--dump-tokens-before-preprocessor"] == true || program["--dump-tokens"] == true)
+    {
+        auto tokenStream = CreateTokenStream(g_context->rootFileID);
+        if (program["--dump-tokens"] == true)
+            tokenStream = Preprocess(std::move(tokenStream));
+
         tokenStream.Dump();
         return 0;
     }
 
-    Parser parser(std::move(tokenStream));
-    g_parsedFile = parser.Parse();
-    g_parsedFile->Typecheck();
+    compilation.context->compilingModule = program["--module"] == true;
+    compilation.context->importPaths = program.get<std::vector<std::string>>("--import-path");
 
-    if (program["--disable-dce"] == false)
-        g_parsedFile->DCE();
+    if (!compilation.Parse(program["--disable-dce"] == false))
+        return PrintErrors(compilation);
 
     if (program["--dump-ast"] == true)
     {
@@ -69,18 +275,115 @@ int main(int argc, char** argv)
         return 0;
     }
 
-    g_parsedFile->Codegen();
+    auto jobs = program.get<uint32_t>("-j");
+    if (jobs == 0)
+        jobs = std::max(std::thread::hardware_concurrency(), 1u);
+
+    if (program["--module"] == true)
+    {
+        auto objectFilename = g_context->OutputFilename(fileType, program.present("-o"));
+        if (!compilation.WriteInterface(OutputFilenames(objectFilename, program).back()))
+            return PrintErrors(compilation);
+    }
 
-    g_context->Finalize();
+    if ((program["--streaming"] == true || program.present("--cache-dir")) &&
+        (fileType != Context::OutputFileType::Executable || g_context->thinLTO || program["--dump-ir"] == true ||
+         program["--dump-asm"] == true))
+    {
+        std::println(std::cerr, "--streaming and --cache-dir can only be used when building an executable without LTO");
+        exit(1);
+    }
 
-    if (program["--dump-ir"] == true)
-        g_context->module->print(llvm::outs(), nullptr);
-    else if (program["--dump-asm"] == true)
-        g_context->Write(Context::OutputFileType::Assembly, program.present("-o"));
-    else if (program["-c"] == true)
-        g_context->Write(Context::OutputFileType::Object, program.present("-o"));
+    std::string outputFilename;
+    if (program["--streaming"] == true)
+    {
+        if (program.present("--cache-dir"))
+        {
+            std::println(std::cerr, "--streaming can't be used with --cache-dir");
+            exit(1);
+        }
+
+        auto written = compilation.WriteStreaming(
+            program.present("-o"), program.get<std::vector<std::string>>("--link"), jobs, program["--verify-ir"] == true);
+        if (!written)
+            return PrintErrors(compilation);
+
+        outputFilename = written.value();
+    }
+    else if (auto cacheDirectory = program.present("--cache-dir"))
+    {
+        std::optional<PhaseTimer> timer;
+        timer.emplace("CodegenBatches");
+        ObjectCache cache(*cacheDirectory, program.get<uint64_t>("--cache-max-size") * 1024 * 1024);
+        auto objects = cache.Compile(jobs, program["--verify-ir"] == true);
+
+        timer.emplace("Link");
+        outputFilename = g_context->OutputFilename(fileType, program.present("-o"));
+        g_context->Link(objects, program.get<std::vector<std::string>>("--link"), outputFilename, jobs);
+    }
     else
-        g_context->Write(Context::OutputFileType::Executable, program.present("-o"), program["--run"] == true);
+    {
+        if (!compilation.Generate(jobs, program["--verify-ir"] == true))
+            return PrintErrors(compilation);
+
+        if (program["--dump-ir"] == true)
+        {
+            g_context->module->print(llvm::outs(), nullptr);
+            return 0;
+        }
+
+        if (program["--dump-asm"] == true)
+            return compilation.Write(Context::OutputFileType::Assembly, program.present("-o")) ? 0 : PrintErrors(compilation);
+
+        auto written = compilation.Write(fileType, program.present("-o"), program.get<std::vector<std::string>>("--link"), jobs);
+        if (!written)
+            return PrintErrors(compilation);
+
+        outputFilename = written.value();
+    }
+
+    // Link inputs and the profile aren't source files, but changing them changes the output too
+    auto inputs = g_context->LoadedFilenames();
+    std::ranges::copy(program.get<std::vector<std::string>>("--link"), std::back_inserter(inputs));
+    if (auto profile = program.present("-fprofile-use"))
+        inputs.push_back(*profile);
+
+    if (program["-MD"] == true || program.present("-MF"))
+    {
+        auto depfile = program.present("-MF").value_or(std::filesystem::path(outputFilename).replace_extension(".d").string());
+        WriteDepfile(depfile, OutputFilenames(outputFilename, program), inputs);
+    }
+
+    if (program["--skip-if-up-to-date"] == true)
+        WriteStamp(outputFilename, arguments, inputs);
+
+    if (program["--size-report"] == true)
+        g_context->PrintSizeReport(outputFilename);
+
+    if (program["--run"] == true)
+    {
+        buildTimer.Finish();
+        execl(outputFilename.c_str(), outputFilename.c_str(), nullptr);
+    }
 
     return 0;
 }
+
+// Errors in the program are reported by Compilation, this catches the ones outside of it (like a bad target or a failed link)
+static int Run(const std::vector<std::string>& arguments)
+{
+    try
+    {
+        return Compile(arguments);
+    }
+    catch (const CompileError& error)
+    {
+        std::println(std::cerr, "{}", error.what());
+        return 1;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    return Run({argv, argv + argc});
+}
@@ -26,11 +26,13 @@ import sys
 import os
 from os import path
 import subprocess
-from typing import List, BinaryIO, Optional
+import time
+from typing import Callable, List, BinaryIO, Optional
 from dataclasses import dataclass, field
 
 COMPILER_PATH = "./build/Neon"
 NEON_EXT = ".ne"
+MODULE_EXT = ".module.ne"
 
 OK_COLOR = "\033[92m"
 WARNING_COLOR = "\033[93m"
@@ -49,6 +51,13 @@ DIDNT_CRASH = f"{OK_COLOR}PASS (didn't crash){RESET_COLOR}"
 NON_OPTIMIZED = "non-optimized"
 OPTIMIZED = "optimized"
 DEBUG_SYMBOLS = "with debug symbols"
+PARALLEL = "optimized on multiple threads"
+STREAMING = "optimized in batches on multiple threads"
+OPTIMIZED_DEBUG_SYMBOLS = "optimized with debug symbols"
+CACHE_MISS = "optimized into the object cache"
+CACHE_HIT = "optimized from the object cache"
+FREESTANDING = "freestanding"
+OPTIMIZED_FREESTANDING = "optimized freestanding"
 
 target = "./tests/"
 output_target = "./tests_build/"
@@ -56,6 +65,47 @@ output_target = "./tests_build/"
 def cmd_run(cmd, **kwargs):
     return subprocess.run(cmd, **kwargs)
 
+# Files named `<test>.<part>.ne` aren't tests, they are compiled into the program together with `<test>.ne`
+# NOTE: Except for `<test>.module.ne`, which is compiled with --module first, `<test>.ne` imports it as "<test>.module"
+def is_test_file(file_path: str) -> bool:
+    return file_path.endswith(NEON_EXT) and "." not in path.basename(file_path)[:-len(NEON_EXT)]
+
+def other_sources(file_path: str) -> List[str]:
+    directory = path.dirname(file_path)
+    prefix = path.basename(file_path)[:-len(NEON_EXT)] + "."
+    return sorted(path.join(directory, entry) for entry in os.listdir(directory)
+                  if entry.startswith(prefix) and entry.endswith(NEON_EXT) and not entry.endswith(MODULE_EXT))
+
+# Arguments of the passes that only work when building executables, they are left out when building modules
+EXECUTABLE_ONLY_ARGS = {"--streaming": 0, "--cache-dir": 1}
+
+def module_compiler_args(compiler_args: List[str]) -> List[str]:
+    args = []
+    skip = 0
+    for arg in compiler_args:
+        if skip > 0:
+            skip -= 1
+        elif arg in EXECUTABLE_ONLY_ARGS:
+            skip = EXECUTABLE_ONLY_ARGS[arg]
+        else:
+            args.append(arg)
+    return args
+
+def compile_test(file_path: str, output_filename: str, compiler_args: List[str] = []) -> subprocess.CompletedProcess:
+    module_args = []
+    module_path = file_path[:-len(NEON_EXT)] + MODULE_EXT
+    if path.isfile(module_path):
+        module_output = output_filename + ".module.o"
+        compilation = cmd_run([COMPILER_PATH, *module_compiler_args(compiler_args), "--module", "-o", module_output, module_path],
+                              capture_output=True)
+        if compilation.returncode != 0:
+            return compilation
+        # NOTE: The interface is written next to the object
+        module_args = ["--import-path", path.dirname(output_filename), "--link", module_output]
+
+    return cmd_run([COMPILER_PATH, *compiler_args, *module_args, "-o", output_filename, file_path, *other_sources(file_path)],
+                   capture_output=True)
+
 def read_blob_field(f: BinaryIO, name: bytes) -> bytes:
     line = f.readline()
     field = b':b ' + name + b' '
@@ -127,7 +177,9 @@ class RunStats:
     ignored_files: List[str] = field(default_factory=list)
     failed_files: List[str] = field(default_factory=list)
 
-def run_pass(file_path: str, tc: TestCase, stats: RunStats, compiler_args, pass_type: str):
+# `check_build` is called after a successful build, it returns what's wrong with it
+def run_pass(file_path: str, tc: TestCase, stats: RunStats, compiler_args, pass_type: str,
+             check_build: Optional[Callable[[], Optional[str]]] = None):
     human_test_name = f"`{file_path[len(target):-len(NEON_EXT)]}`"
 
     print(f"{INFO}: Testing {human_test_name} ({pass_type}): ", end="")
@@ -137,7 +189,7 @@ def run_pass(file_path: str, tc: TestCase, stats: RunStats, compiler_args, pass_
 
     output_filename = os.path.join(output_location, os.path.basename(file_path)[:-len(NEON_EXT)])
 
-    compilation = cmd_run([COMPILER_PATH, *compiler_args, "-o", output_filename, file_path], capture_output=True)
+    compilation = compile_test(file_path, output_filename, compiler_args)
     if compilation.returncode != 0:
         stats.failed += 1
         if compilation.returncode == -11:
@@ -153,6 +205,15 @@ def run_pass(file_path: str, tc: TestCase, stats: RunStats, compiler_args, pass_
         print(DOESNT_BUILD)
         return
 
+    if check_build is not None:
+        problem = check_build()
+        if problem is not None:
+            print(FAILURE)
+            print(f"{ERROR}: {problem}")
+            stats.failed_files.append(f"{human_test_name} ({pass_type}, build)")
+            stats.failed += 1
+            return
+
     application = cmd_run([output_filename, *tc.argv], input=tc.stdin, capture_output=True)
 
     if application.returncode != tc.returncode:
@@ -202,7 +263,7 @@ def run_test_for_file(file_path: str, stats: RunStats = RunStats()):
 
     if tc is None:
         print(f"{WARNING}: Could not find test case data for {human_test_name}. Only making sure the compiler doesn't crash: ", end="")
-        compilation = cmd_run([COMPILER_PATH, "-o", output_filename, file_path], capture_output=True)
+        compilation = compile_test(file_path, output_filename)
         if compilation.returncode in [0, 1]:
             print(DIDNT_CRASH)
         else:
@@ -215,8 +276,15 @@ def run_test_for_file(file_path: str, stats: RunStats = RunStats()):
     if not tc.builds:
         print(f"{INFO}: Testing {human_test_name} expected build fail: ", end="")
 
-        compilation = cmd_run([COMPILER_PATH, "-o", output_filename, file_path], capture_output=True)
-        if compilation.returncode == 1:
+        # NOTE: The stderr of a test that doesn't build is a part of the error it expects, filenames in errors depend on the target
+        compilation = compile_test(file_path, output_filename)
+        if compilation.returncode == 1 and tc.stderr not in compilation.stderr:
+            stats.failed_files.append(f"{human_test_name} (expected build fail, wrong error)")
+            stats.failed += 1
+            print(FAILURE)
+            print(f"{ERROR}: Expected an error containing {tc.stderr!r}")
+            print(f"  Actual: {compilation.stderr}")
+        elif compilation.returncode == 1:
             stats.passed += 1
             print(PASS)
         elif compilation.returncode == 0:
@@ -229,14 +297,27 @@ def run_test_for_file(file_path: str, stats: RunStats = RunStats()):
             print(COMPILER_CRASH)
         return
 
-    run_pass(file_path, tc, stats, [], NON_OPTIMIZED)
-    run_pass(file_path, tc, stats, ["-O"], OPTIMIZED)
-    run_pass(file_path, tc, stats, ["-g"], DEBUG_SYMBOLS)
+    # NOTE: The compiler doesn't verify the IR by default, the tests should catch invalid IR though
+    run_pass(file_path, tc, stats, ["--verify-ir"], NON_OPTIMIZED)
+    run_pass(file_path, tc, stats, ["--verify-ir", "-O"], OPTIMIZED)
+    run_pass(file_path, tc, stats, ["--verify-ir", "-g"], DEBUG_SYMBOLS)
+    run_pass(file_path, tc, stats, ["--verify-ir", "-O", "-j", "4"], PARALLEL)
+    run_pass(file_path, tc, stats, ["--verify-ir", "-O", "--streaming", "-j", "4"], STREAMING)
+    run_pass(file_path, tc, stats, ["--verify-ir", "-O", "-g"], OPTIMIZED_DEBUG_SYMBOLS)
+    run_pass(file_path, tc, stats, ["--verify-ir", "--freestanding"], FREESTANDING)
+    run_pass(file_path, tc, stats, ["--verify-ir", "--freestanding", "-O"], OPTIMIZED_FREESTANDING)
+    cache_dir = path.join(output_target, "cache")
+    run_pass(file_path, tc, stats, ["--verify-ir", "-O", "--cache-dir", cache_dir], CACHE_MISS)
+    cached_objects = set(os.listdir(cache_dir)) if path.isdir(cache_dir) else set()
+    def nothing_new_cached():
+        new_objects = set(os.listdir(cache_dir)) - cached_objects
+        return f"The cache wasn't reused, {len(new_objects)} new objects were written to it" if new_objects else None
+    run_pass(file_path, tc, stats, ["--verify-ir", "-O", "--cache-dir", cache_dir], CACHE_HIT, nothing_new_cached)
     # TODO: Test validity of the IR with llc
 
 def run_test_for_subfolder(folder: str, stats: RunStats):
     for entry in os.scandir(folder):
-        if entry.is_file() and entry.path.endswith(NEON_EXT):
+        if entry.is_file() and is_test_file(entry.path):
             run_test_for_file(entry.path, stats)
         elif entry.is_dir():
             run_test_for_subfolder(entry.path, stats)
@@ -245,7 +326,7 @@ def run_test_for_folder(folder: str):
     stats = RunStats()
 
     for entry in os.scandir(folder):
-        if entry.is_file() and entry.path.endswith(NEON_EXT):
+        if entry.is_file() and is_test_file(entry.path):
             run_test_for_file(entry.path, stats)
         elif entry.is_dir():
             run_test_for_subfolder(entry.path, stats)
@@ -292,7 +373,7 @@ def update_output_for_file(file_path: str):
 
     output_filename = os.path.join(output_location, os.path.basename(file_path)[:-len(NEON_EXT)])
 
-    compilation = cmd_run([COMPILER_PATH, "-o", output_filename, file_path], capture_output=True)
+    compilation = compile_test(file_path, output_filename)
 
     if compilation.returncode == 0:
         output = cmd_run([output_filename, *tc.argv], input=tc.stdin, capture_output=True)
@@ -309,22 +390,51 @@ def update_output_for_file(file_path: str):
 
 def update_output_for_folder(folder: str):
     for entry in os.scandir(folder):
-        if entry.is_file() and entry.path.endswith(NEON_EXT):
+        if entry.is_file() and is_test_file(entry.path):
             update_output_for_file(entry.path)
         elif entry.is_dir():
             update_output_for_folder(entry.path)
 
+def time_compiler_for_folder(folder: str, compiler_args: List[str], repeat: int):
+    test_files = []
+    for root, _, files in os.walk(folder):
+        for file in sorted(files):
+            file_path = path.join(root, file)
+            tc = load_test_case(file_path[:-len(NEON_EXT)] + ".txt") if is_test_file(file_path) else None
+            if tc is not None and tc.builds:
+                test_files.append(file_path)
+
+    os.makedirs(output_target, exist_ok=True)
+    output_filename = path.join(output_target, "timed")
+
+    # NOTE: The best of several runs is the least disturbed by whatever else the machine is doing
+    best_total = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        for file_path in test_files:
+            compile_test(file_path, output_filename, compiler_args)
+        total = time.perf_counter() - start
+        best_total = total if best_total is None else min(best_total, total)
+
+    print(f"{INFO}: Compiled {len(test_files)} tests with {compiler_args} in {best_total:.3f}s (best of {repeat})")
+
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description='Run or update the tests.')
     group = parser.add_mutually_exclusive_group()
     group.add_argument("-u", "--update", action="store_true", help="update the output of the tests")
     group.add_argument("--update-input", action="store_true", help="update the input of the tests")
+    group.add_argument("--time-compiler", nargs="?", const="", metavar="ARGS",
+                       help="only time compiling the tests that build, with these compiler arguments (e.g. --time-compiler=-O)")
+    parser.add_argument("--repeat", type=int, default=5, help="how many times --time-compiler compiles the tests")
+    parser.add_argument("--compiler", default=COMPILER_PATH,
+                        help="compiler to test or time, e.g. one built from an earlier commit to compare with")
     parser.add_argument("-o", "--output", help="output target", default="./tests_build/")
     parser.add_argument("target", help="target to run the tests on", default="./tests/", nargs='?')
     args = parser.parse_args()
 
     target = args.target
     output_target = args.output
+    COMPILER_PATH = args.compiler
 
     if target == output_target:
         print(f"{ERROR}: target and output cannot be the same")
@@ -347,6 +457,10 @@ if __name__ == "__main__":
             assert False, 'unreachable'
         exit(0)
 
+    if args.time_compiler is not None:
+        time_compiler_for_folder(target, args.time_compiler.split(), args.repeat)
+        exit(0)
+
     if args.update_input:
         if path.isfile(target):
             update_input_for_file(target, [])
@@ -0,0 +1,129 @@
+#include <Compilation.h>
+
+#include <array>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <print>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+// Compiles, links and runs programs on separate threads of one process, like a program embedding the compiler can
+// NOTE: Runs from the root of the repository, like test.py, because the programs include files from lib/
+
+struct TestProgram
+{
+    std::string name;
+    std::string source;
+    int exitCode;
+};
+
+static const std::array testPrograms = {
+    TestProgram{
+        "standard",
+        R"(include "Standard"
+
+function main(): int32
+{
+    print("Hello from a thread\n");
+    return 3;
+}
+)",
+        3},
+    TestProgram{
+        "structs",
+        R"(struct Pair
+{
+    a: int32;
+    b: int32;
+}
+
+function sum(pair: Pair): int32
+{
+    return pair.a + pair.b;
+}
+
+function main(): int32
+{
+    var pair: Pair;
+    pair.a = 4;
+    pair.b = 5;
+    return sum(pair);
+}
+)",
+        9},
+};
+
+// Every thread builds its program this many times, so the builds overlap
+static constexpr int buildsPerThread = 4;
+
+[[nodiscard]] static bool BuildAndRun(const TestProgram& program, const std::filesystem::path& outputDirectory)
+{
+    auto filename = program.name + ".ne";
+    auto outputFilename = (outputDirectory / program.name).string();
+
+    try
+    {
+        Compilation compilation(MakeRef<Context>(
+            filename,
+            ContextOptions{.optimizationLevel = llvm::OptimizationLevel::O2},
+            std::map<std::string, std::string>{{filename, program.source}}));
+
+        if (!compilation.Parse() || !compilation.Generate() ||
+            !compilation.Write(Context::OutputFileType::Executable, outputFilename))
+        {
+            for (const auto& error : compilation.errors)
+                std::println(std::cerr, "{}: {}", program.name, error.what());
+
+            return false;
+        }
+    }
+    catch (const CompileError& error)
+    {
+        std::println(std::cerr, "{}: {}", program.name, error.what());
+        return false;
+    }
+
+    auto status = std::system(outputFilename.c_str());
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != program.exitCode)
+    {
+        std::println(std::cerr, "{}: expected exit code {}, got status {}", program.name, program.exitCode, status);
+        return false;
+    }
+
+    return true;
+}
+
+int main()
+{
+    auto outputDirectory = std::filesystem::temp_directory_path() / std::format("neon-library-tests-{}", getpid());
+    std::filesystem::create_directories(outputDirectory);
+
+    std::array<bool, testPrograms.size()> passed{};
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < testPrograms.size(); i++)
+    {
+        threads.emplace_back(
+            [&, i]
+            {
+                passed[i] = true;
+                for (int build = 0; build < buildsPerThread; build++)
+                    passed[i] = BuildAndRun(testPrograms[i], outputDirectory) && passed[i];
+            });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    std::filesystem::remove_all(outputDirectory);
+
+    bool allPassed = true;
+    for (size_t i = 0; i < testPrograms.size(); i++)
+    {
+        std::println("{}: {}", testPrograms[i].name, passed[i] ? "PASS" : "FAILURE");
+        allPassed = allPassed && passed[i];
+    }
+
+    return allPassed ? 0 : 1;
+}